@@ -0,0 +1,31 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+// Counts every global heap allocation, so the info text can show how many the simulation makes each tick.
+// The count is per thread, so the sim thread's count isn't mixed up with the render thread's.
+// This replaces the global operator new and delete, so it must only be included from main.cpp.
+thread_local uint64_t heapAllocations = 0;
+
+void *operator new(std::size_t size)
+{
+    heapAllocations++;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
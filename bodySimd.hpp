@@ -0,0 +1,146 @@
+#ifndef BODY_SIMD_HPP
+#define BODY_SIMD_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The joints of up to 8 fish with the same number of joints, stored joint-major (structure of arrays) so each fish is one SIMD lane.
+// Lanes past laneCount hold copies of lane 0 so they never produce NaNs, and their results are ignored.
+struct BodyBatch
+{
+    static constexpr int lanes = 8;
+
+    int jointCount = 0;
+    int laneCount = 0;
+
+    std::vector<float> x; // x[joint * lanes + lane] is the x position of joint `joint` of the fish in lane `lane`
+    std::vector<float> y;
+    std::vector<float> forwardX; // Unit forward direction of each joint after constraining, laid out like x (see Fish::updateSkeleton)
+    std::vector<float> forwardY;
+
+    // Per-lane values
+    float backX[lanes]; // Unit vector pointing backwards out of the head (-forward)
+    float backY[lanes];
+    float linkDistance[lanes];
+    float cosMaxTurnAngle[lanes];
+    float sinMaxTurnAngle[lanes];
+
+    void resize(int _jointCount)
+    {
+        jointCount = _jointCount;
+        x.resize(jointCount * lanes);
+        y.resize(jointCount * lanes);
+        forwardX.resize(jointCount * lanes);
+        forwardY.resize(jointCount * lanes);
+    }
+};
+
+// Constrains every joint of every lane in the batch and fills in their forward directions, the same way Fish::constrain does for one fish
+typedef void (*ConstrainKernel)(BodyBatch &batch);
+
+// Handles one lane at a time. Used as the fallback.
+void constrainBatchScalar(BodyBatch &batch)
+{
+    for (int lane = 0; lane < batch.laneCount; lane++)
+    {
+        glm::vec2 back = {batch.backX[lane], batch.backY[lane]};
+        batch.forwardX[lane] = -back.x;
+        batch.forwardY[lane] = -back.y;
+        for (int j = 1; j < batch.jointCount; j++)
+        {
+            int prev = (j - 1) * BodyBatch::lanes + lane;
+            int cur = j * BodyBatch::lanes + lane;
+            glm::vec2 diff = glm::normalize(glm::vec2(batch.x[cur] - batch.x[prev], batch.y[cur] - batch.y[prev]));
+
+            float cosAngle = glm::dot(back, diff);
+            if (cosAngle < batch.cosMaxTurnAngle[lane])
+            {
+                float sinAngle = back.x * diff.y - back.y * diff.x;
+                float cs = batch.cosMaxTurnAngle[lane];
+                float sn = sinAngle >= 0.0f ? batch.sinMaxTurnAngle[lane] : -batch.sinMaxTurnAngle[lane];
+                diff = {back.x * cs - back.y * sn,
+                        back.x * sn + back.y * cs};
+            }
+            batch.x[cur] = batch.x[prev] + diff.x * batch.linkDistance[lane];
+            batch.y[cur] = batch.y[prev] + diff.y * batch.linkDistance[lane];
+            batch.forwardX[cur] = -diff.x;
+            batch.forwardY[cur] = -diff.y;
+            back = diff;
+        }
+    }
+}
+
+#ifdef __SSE2__
+
+// Handles 4 lanes at a time with SSE2, so a batch takes two passes
+void constrainBatchSSE2(BodyBatch &batch)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (int half = 0; half < BodyBatch::lanes; half += 4)
+    {
+        __m128 backX = _mm_loadu_ps(batch.backX + half);
+        __m128 backY = _mm_loadu_ps(batch.backY + half);
+        __m128 linkDistance = _mm_loadu_ps(batch.linkDistance + half);
+        __m128 cs = _mm_loadu_ps(batch.cosMaxTurnAngle + half);
+        __m128 sinMax = _mm_loadu_ps(batch.sinMaxTurnAngle + half);
+        __m128 prevX = _mm_loadu_ps(batch.x.data() + half);
+        __m128 prevY = _mm_loadu_ps(batch.y.data() + half);
+        _mm_storeu_ps(batch.forwardX.data() + half, _mm_sub_ps(zero, backX));
+        _mm_storeu_ps(batch.forwardY.data() + half, _mm_sub_ps(zero, backY));
+
+        for (int j = 1; j < batch.jointCount; j++)
+        {
+            float *curX = batch.x.data() + j * BodyBatch::lanes + half;
+            float *curY = batch.y.data() + j * BodyBatch::lanes + half;
+
+            // Constrain distance
+            __m128 diffX = _mm_sub_ps(_mm_loadu_ps(curX), prevX);
+            __m128 diffY = _mm_sub_ps(_mm_loadu_ps(curY), prevY);
+            // Multiply by the reciprocal like glm::normalize (v * inversesqrt(dot(v, v))) so the results match constrainLink
+            __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(diffX, diffX), _mm_mul_ps(diffY, diffY))));
+            diffX = _mm_mul_ps(diffX, inverseLength);
+            diffY = _mm_mul_ps(diffY, inverseLength);
+
+            // Constrain angle
+            __m128 cosAngle = _mm_add_ps(_mm_mul_ps(backX, diffX), _mm_mul_ps(backY, diffY));
+            __m128 sinAngle = _mm_sub_ps(_mm_mul_ps(backX, diffY), _mm_mul_ps(backY, diffX));
+            __m128 positive = _mm_cmpge_ps(sinAngle, zero);
+            __m128 sn = _mm_or_ps(_mm_and_ps(positive, sinMax), _mm_andnot_ps(positive, _mm_sub_ps(zero, sinMax)));
+            __m128 clampedX = _mm_sub_ps(_mm_mul_ps(backX, cs), _mm_mul_ps(backY, sn));
+            __m128 clampedY = _mm_add_ps(_mm_mul_ps(backX, sn), _mm_mul_ps(backY, cs));
+            __m128 tooFar = _mm_cmplt_ps(cosAngle, cs);
+            diffX = _mm_or_ps(_mm_and_ps(tooFar, clampedX), _mm_andnot_ps(tooFar, diffX));
+            diffY = _mm_or_ps(_mm_and_ps(tooFar, clampedY), _mm_andnot_ps(tooFar, diffY));
+
+            prevX = _mm_add_ps(prevX, _mm_mul_ps(diffX, linkDistance));
+            prevY = _mm_add_ps(prevY, _mm_mul_ps(diffY, linkDistance));
+            _mm_storeu_ps(curX, prevX);
+            _mm_storeu_ps(curY, prevY);
+            _mm_storeu_ps(batch.forwardX.data() + j * BodyBatch::lanes + half, _mm_sub_ps(zero, diffX));
+            _mm_storeu_ps(batch.forwardY.data() + j * BodyBatch::lanes + half, _mm_sub_ps(zero, diffY));
+            backX = diffX;
+            backY = diffY;
+        }
+    }
+}
+
+#endif
+
+// Pick the fastest constrain kernel. An 8-wide AVX version measured no faster than two SSE2 passes, since each joint depends on the one before it.
+ConstrainKernel selectConstrainKernel()
+{
+#ifdef __SSE2__
+    return constrainBatchSSE2;
+#else
+    return constrainBatchScalar;
+#endif
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef BOIDS_SIMD_HPP
+#define BOIDS_SIMD_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BOIDS_SIMD_X86
+#endif
+
+// Totals gathered from a fish's neighbors in a single pass, used to build the separation, alignment and cohesion directions
+struct NeighborSums
+{
+    glm::vec2 separation = {0.0f, 0.0f}; // Sum of diff / distance^2 for neighbors within the separationRadius
+    glm::vec2 alignment = {0.0f, 0.0f};  // Sum of the forward directions of neighbors within the alignmentRadius
+    glm::vec2 cohesion = {0.0f, 0.0f};   // Sum of the head positions of neighbors within the cohesionRadius
+    int separationCount = 0;
+    int alignmentCount = 0;
+    int cohesionCount = 0;
+};
+
+// Everything a neighbor kernel needs to know about the fish it is gathering for, plus the flock arrays it reads from
+struct NeighborQuery
+{
+    const float *headX;
+    const float *headY;
+    const float *forwardX;
+    const float *forwardY;
+
+    uint32_t self; // Index of the fish being gathered for, skipped if it shows up as a candidate
+    glm::vec2 pos; // Head position of the fish being gathered for
+
+    float separationRadius2;
+    float alignmentRadius2;
+    float cohesionRadius2;
+};
+
+// Adds the contribution of candidates[0] to candidates[count - 1] to sums
+typedef void (*NeighborKernel)(const NeighborQuery &query, const uint32_t *candidates, int count, NeighborSums &sums);
+
+// Handles one candidate at a time. Used as the fallback and for the leftover candidates of the SIMD kernels.
+void accumulateNeighborsScalar(const NeighborQuery &query, const uint32_t *candidates, int count, NeighborSums &sums)
+{
+    for (int k = 0; k < count; k++)
+    {
+        uint32_t other = candidates[k];
+        if (other == query.self)
+            continue;
+
+        glm::vec2 otherPos = {query.headX[other], query.headY[other]};
+        glm::vec2 diff = query.pos - otherPos;
+        float distance2 = diff.x * diff.x + diff.y * diff.y;
+
+        if (distance2 < query.separationRadius2 && distance2 > 0)
+        {
+            sums.separation += diff / distance2; // normalize(diff) / distance
+            sums.separationCount++;
+        }
+        if (distance2 < query.alignmentRadius2)
+        {
+            sums.alignment += glm::vec2(query.forwardX[other], query.forwardY[other]);
+            sums.alignmentCount++;
+        }
+        if (distance2 < query.cohesionRadius2)
+        {
+            sums.cohesion += otherPos;
+            sums.cohesionCount++;
+        }
+    }
+}
+
+#ifdef __SSE2__
+
+// Add up the 4 lanes of v
+float horizontalSum(__m128 v)
+{
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Handles 4 candidates at a time with SSE2, which every x86-64 CPU has
+void accumulateNeighborsSSE2(const NeighborQuery &query, const uint32_t *candidates, int count, NeighborSums &sums)
+{
+    const __m128 posX = _mm_set1_ps(query.pos.x);
+    const __m128 posY = _mm_set1_ps(query.pos.y);
+    const __m128 separationRadius2 = _mm_set1_ps(query.separationRadius2);
+    const __m128 alignmentRadius2 = _mm_set1_ps(query.alignmentRadius2);
+    const __m128 cohesionRadius2 = _mm_set1_ps(query.cohesionRadius2);
+    const __m128i self = _mm_set1_epi32((int)query.self);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 separationX = zero, separationY = zero, separationCount = zero;
+    __m128 alignmentX = zero, alignmentY = zero, alignmentCount = zero;
+    __m128 cohesionX = zero, cohesionY = zero, cohesionCount = zero;
+
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const uint32_t *c = candidates + k;
+        __m128 headX = _mm_set_ps(query.headX[c[3]], query.headX[c[2]], query.headX[c[1]], query.headX[c[0]]);
+        __m128 headY = _mm_set_ps(query.headY[c[3]], query.headY[c[2]], query.headY[c[1]], query.headY[c[0]]);
+        __m128 forwardX = _mm_set_ps(query.forwardX[c[3]], query.forwardX[c[2]], query.forwardX[c[1]], query.forwardX[c[0]]);
+        __m128 forwardY = _mm_set_ps(query.forwardY[c[3]], query.forwardY[c[2]], query.forwardY[c[1]], query.forwardY[c[0]]);
+
+        __m128 diffX = _mm_sub_ps(posX, headX);
+        __m128 diffY = _mm_sub_ps(posY, headY);
+        __m128 distance2 = _mm_add_ps(_mm_mul_ps(diffX, diffX), _mm_mul_ps(diffY, diffY));
+
+        __m128i indices = _mm_loadu_si128((const __m128i *)c);
+        __m128 isSelf = _mm_castsi128_ps(_mm_cmpeq_epi32(indices, self));
+
+        __m128 separationMask = _mm_andnot_ps(isSelf, _mm_and_ps(_mm_cmplt_ps(distance2, separationRadius2), _mm_cmpgt_ps(distance2, zero)));
+        __m128 alignmentMask = _mm_andnot_ps(isSelf, _mm_cmplt_ps(distance2, alignmentRadius2));
+        __m128 cohesionMask = _mm_andnot_ps(isSelf, _mm_cmplt_ps(distance2, cohesionRadius2));
+
+        // Masked-off lanes are zeroed by the and, so a 0 distance dividing to inf/NaN never reaches the sums
+        __m128 inverseDistance2 = _mm_div_ps(one, distance2);
+        separationX = _mm_add_ps(separationX, _mm_and_ps(separationMask, _mm_mul_ps(diffX, inverseDistance2)));
+        separationY = _mm_add_ps(separationY, _mm_and_ps(separationMask, _mm_mul_ps(diffY, inverseDistance2)));
+        separationCount = _mm_add_ps(separationCount, _mm_and_ps(separationMask, one));
+
+        alignmentX = _mm_add_ps(alignmentX, _mm_and_ps(alignmentMask, forwardX));
+        alignmentY = _mm_add_ps(alignmentY, _mm_and_ps(alignmentMask, forwardY));
+        alignmentCount = _mm_add_ps(alignmentCount, _mm_and_ps(alignmentMask, one));
+
+        cohesionX = _mm_add_ps(cohesionX, _mm_and_ps(cohesionMask, headX));
+        cohesionY = _mm_add_ps(cohesionY, _mm_and_ps(cohesionMask, headY));
+        cohesionCount = _mm_add_ps(cohesionCount, _mm_and_ps(cohesionMask, one));
+    }
+
+    // Reduce the lanes into the sums
+    sums.separation += glm::vec2(horizontalSum(separationX), horizontalSum(separationY));
+    sums.alignment += glm::vec2(horizontalSum(alignmentX), horizontalSum(alignmentY));
+    sums.cohesion += glm::vec2(horizontalSum(cohesionX), horizontalSum(cohesionY));
+    sums.separationCount += (int)horizontalSum(separationCount);
+    sums.alignmentCount += (int)horizontalSum(alignmentCount);
+    sums.cohesionCount += (int)horizontalSum(cohesionCount);
+
+    accumulateNeighborsScalar(query, candidates + k, count - k, sums);
+}
+
+#endif
+
+#ifdef BOIDS_SIMD_X86
+
+// Add up the 8 lanes of v
+__attribute__((target("avx2"))) float horizontalSum(__m256 v)
+{
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, v);
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// Handles 8 candidates at a time with AVX2 gathers. Only called if the CPU supports AVX2 (see selectNeighborKernel).
+__attribute__((target("avx2"))) void accumulateNeighborsAVX2(const NeighborQuery &query, const uint32_t *candidates, int count, NeighborSums &sums)
+{
+    const __m256 posX = _mm256_set1_ps(query.pos.x);
+    const __m256 posY = _mm256_set1_ps(query.pos.y);
+    const __m256 separationRadius2 = _mm256_set1_ps(query.separationRadius2);
+    const __m256 alignmentRadius2 = _mm256_set1_ps(query.alignmentRadius2);
+    const __m256 cohesionRadius2 = _mm256_set1_ps(query.cohesionRadius2);
+    const __m256i self = _mm256_set1_epi32((int)query.self);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 separationX = zero, separationY = zero, separationCount = zero;
+    __m256 alignmentX = zero, alignmentY = zero, alignmentCount = zero;
+    __m256 cohesionX = zero, cohesionY = zero, cohesionCount = zero;
+
+    int k = 0;
+    for (; k + 8 <= count; k += 8)
+    {
+        __m256i indices = _mm256_loadu_si256((const __m256i *)(candidates + k));
+        __m256 headX = _mm256_i32gather_ps(query.headX, indices, 4);
+        __m256 headY = _mm256_i32gather_ps(query.headY, indices, 4);
+
+        __m256 diffX = _mm256_sub_ps(posX, headX);
+        __m256 diffY = _mm256_sub_ps(posY, headY);
+        __m256 distance2 = _mm256_add_ps(_mm256_mul_ps(diffX, diffX), _mm256_mul_ps(diffY, diffY));
+
+        __m256 isSelf = _mm256_castsi256_ps(_mm256_cmpeq_epi32(indices, self));
+
+        __m256 separationMask = _mm256_andnot_ps(isSelf, _mm256_and_ps(_mm256_cmp_ps(distance2, separationRadius2, _CMP_LT_OQ), _mm256_cmp_ps(distance2, zero, _CMP_GT_OQ)));
+        __m256 alignmentMask = _mm256_andnot_ps(isSelf, _mm256_cmp_ps(distance2, alignmentRadius2, _CMP_LT_OQ));
+        __m256 cohesionMask = _mm256_andnot_ps(isSelf, _mm256_cmp_ps(distance2, cohesionRadius2, _CMP_LT_OQ));
+
+        // Masked-off lanes are zeroed by the and, so a 0 distance dividing to inf/NaN never reaches the sums
+        __m256 inverseDistance2 = _mm256_div_ps(one, distance2);
+        separationX = _mm256_add_ps(separationX, _mm256_and_ps(separationMask, _mm256_mul_ps(diffX, inverseDistance2)));
+        separationY = _mm256_add_ps(separationY, _mm256_and_ps(separationMask, _mm256_mul_ps(diffY, inverseDistance2)));
+        separationCount = _mm256_add_ps(separationCount, _mm256_and_ps(separationMask, one));
+
+        __m256 forwardX = _mm256_i32gather_ps(query.forwardX, indices, 4);
+        __m256 forwardY = _mm256_i32gather_ps(query.forwardY, indices, 4);
+        alignmentX = _mm256_add_ps(alignmentX, _mm256_and_ps(alignmentMask, forwardX));
+        alignmentY = _mm256_add_ps(alignmentY, _mm256_and_ps(alignmentMask, forwardY));
+        alignmentCount = _mm256_add_ps(alignmentCount, _mm256_and_ps(alignmentMask, one));
+
+        cohesionX = _mm256_add_ps(cohesionX, _mm256_and_ps(cohesionMask, headX));
+        cohesionY = _mm256_add_ps(cohesionY, _mm256_and_ps(cohesionMask, headY));
+        cohesionCount = _mm256_add_ps(cohesionCount, _mm256_and_ps(cohesionMask, one));
+    }
+
+    // Reduce the lanes into the sums
+    sums.separation += glm::vec2(horizontalSum(separationX), horizontalSum(separationY));
+    sums.alignment += glm::vec2(horizontalSum(alignmentX), horizontalSum(alignmentY));
+    sums.cohesion += glm::vec2(horizontalSum(cohesionX), horizontalSum(cohesionY));
+    sums.separationCount += (int)horizontalSum(separationCount);
+    sums.alignmentCount += (int)horizontalSum(alignmentCount);
+    sums.cohesionCount += (int)horizontalSum(cohesionCount);
+
+    accumulateNeighborsScalar(query, candidates + k, count - k, sums);
+}
+
+#endif
+
+// Pick the fastest neighbor kernel the CPU running the game supports
+NeighborKernel selectNeighborKernel()
+{
+#ifdef BOIDS_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return accumulateNeighborsAVX2;
+    }
+#ifdef __SSE2__
+    return accumulateNeighborsSSE2;
+#endif
+#endif
+    return accumulateNeighborsScalar;
+}
+
+#endif
@@ -4,6 +4,30 @@
 #include "random.hpp"
 #include "helperUtils.hpp"
 #include "rod.hpp"
+#include "slotMap.hpp"
+#include "spatialGrid.hpp"
+#include "boidsSimd.hpp"
+#include "quadTree.hpp"
+#include "kdTree.hpp"
+#include "influenceMap.hpp"
+#include "signedDistanceField.hpp"
+#include "pondShape.hpp"
+#include "bodySimd.hpp"
+#include "fishBody.hpp"
+#include "threadPool.hpp"
+
+// The colors and other values that are only needed to draw a fish
+struct FishAppearance
+{
+    sf::Color bodyColor;
+    sf::Color finColor;
+    sf::Color tailColor;
+    sf::Color eyeColor;
+
+    float eyeRadius = 0.025f;
+    float normalFinRotation = 30.0f;
+    float turnFinRotation = 20.0f;
+};
 
 struct FishType
 {
@@ -16,6 +40,10 @@ struct FishType
     sf::Color tailColor;
     sf::Color eyeColor;
 
+    // Body shape
+    int jointCount;
+    std::vector<float> sizeProfile; // Joint sizes relative to headSize, spread evenly from head to tail and interpolated between
+
     // Constructor to make creating fish types easier
     FishType(const std::string _name,
              float _headSize,
@@ -24,7 +52,9 @@ struct FishType
              const sf::Color _bodyColor,
              const sf::Color _finColor,
              const sf::Color _tailColor,
-             const sf::Color _eyeColor)
+             const sf::Color _eyeColor,
+             int _jointCount = 5,
+             const std::vector<float> &_sizeProfile = {1.0f, 4.0f / 3.0f, 1.0f, 2.0f / 3.0f, 1.0f / 3.0f})
         : name(_name),
           headSize(_headSize),
           linkDistanceMultiplier(_linkDistanceMultiplier),
@@ -32,23 +62,89 @@ struct FishType
           bodyColor(_bodyColor),
           finColor(_finColor),
           tailColor(_tailColor),
-          eyeColor(_eyeColor) {}
+          eyeColor(_eyeColor),
+          jointCount(_jointCount),
+          sizeProfile(_sizeProfile) {}
+
+    // Get the size of joint jointIndex of fish of this type
+    float jointSize(int jointIndex) const
+    {
+        if (sizeProfile.empty())
+            return headSize;
+        if (jointCount < 2 || sizeProfile.size() < 2)
+            return headSize * sizeProfile[0];
+
+        float t = jointIndex * (sizeProfile.size() - 1) / (float)(jointCount - 1);
+        int i = std::min((int)t, (int)sizeProfile.size() - 2);
+        return headSize * (sizeProfile[i] + (sizeProfile[i + 1] - sizeProfile[i]) * (t - i));
+    }
+
+    // Get the appearance of fish of this type
+    FishAppearance appearance() const
+    {
+        FishAppearance result;
+        result.bodyColor = bodyColor;
+        result.finColor = finColor;
+        result.tailColor = tailColor;
+        result.eyeColor = eyeColor;
+        return result;
+    }
+};
+
+// Every fish type, each with a small ID. Fish only store the ID of their type and look everything else up here.
+struct FishTypeRegistry
+{
+    std::vector<FishType> types;
+    std::vector<FishAppearance> appearances; // Appearance of each type, so rendering doesn't have to rebuild it
+
+    // Add a fish type, returning its ID
+    uint16_t add(const FishType &type)
+    {
+        types.push_back(type);
+        appearances.push_back(type.appearance());
+        return types.size() - 1;
+    }
+
+    size_t size() const
+    {
+        return types.size();
+    }
+
+    const FishType &operator[](uint16_t typeId) const
+    {
+        return types[typeId];
+    }
 };
 
+// A single fish. Everything it shares with the rest of its species, like its name and colors, is in its FishType (see typeId).
 struct Fish
 {
     // Misc
     uint32_t randSeed = 42;
+    Handle handle; // Stays the same while the fish is in the flock, see Flock::getFish
 
-    // Structure
-    std::vector<glm::vec2> points;
-    std::vector<float> sizes;
+    // Structure. The joints are stored in a JointStore shared by the whole flock, at jointOffset to jointOffset + jointCount - 1.
+    JointStore *joints;
+    uint32_t jointOffset = 0;
+    int jointCount = 0;
     float linkDistance;
 
+    // Skeleton cache, stored next to the joints (JointStore::forwards and JointStore::angles).
+    // The joint forward directions are written by constrain(), which works them out anyway.
+    // The joint angles and the curvature are worked out the first time they are needed after that, so at most once per frame.
+    float cachedCurvature = 0.0f;
+    bool forwardsValid = false;
+    bool anglesValid = false;
+    static inline uint64_t skeletonMathCalls = 0; // Number of atan2 and normalize calls made to work out the skeleton and render fish, shown in the info text
+
     // Movement
     float moveSpeed;
     glm::vec2 forward = {-1.0f, 0.0f};
+    glm::vec2 previousForward = {-1.0f, 0.0f}; // forward before the last step, see Flock::savePreviousState
+    glm::vec2 desiredDirection = {0.0f, 0.0f}; // Direction the flock last steered this fish towards, held between steering updates
     float maxTurnAngle = 30.0f;
+    float cosMaxTurnAngle; // cos and sin of maxTurnAngle, so constrain() doesn't need any trig. Set with setMaxTurnAngle.
+    float sinMaxTurnAngle;
 
     // Hook
     bool hooked = false;
@@ -56,33 +152,40 @@ struct Fish
     bool pulled = false;
 
     // Fish Appearance
-    float eyeRadius = 0.025f;
-    float normalFinRotation = 30.0f;
-    float turnFinRotation = 20.0f;
-    int finIndex;
+    int finIndex = 1;
     float finSize = FLT_MIN;
 
-    sf::Color bodyColor;
-    sf::Color finColor;
-    sf::Color tailColor;
-    sf::Color eyeColor;
-
     // Info
-    std::string name;
+    uint16_t typeId; // ID of the fish's type in the flock's FishTypeRegistry
 
-    Fish(float _linkDistance, float _moveSpeed, sf::Color _bodyColor, sf::Color _finColor, sf::Color _tailColor, sf::Color _eyeColor, std::string _name)
-        : linkDistance(_linkDistance),
+    Fish(JointStore &_joints, float _linkDistance, float _moveSpeed, uint16_t _typeId)
+        : joints(&_joints),
+          linkDistance(_linkDistance),
           moveSpeed(_moveSpeed),
-          bodyColor(_bodyColor),
-          finColor(_finColor),
-          tailColor(_tailColor),
-          eyeColor(_eyeColor),
-          name(_name) {}
+          typeId(_typeId)
+    {
+        setMaxTurnAngle(maxTurnAngle);
+    }
+
+    // Sets the largest angle in degrees each joint can bend
+    void setMaxTurnAngle(float degrees)
+    {
+        maxTurnAngle = degrees;
+        cosMaxTurnAngle = std::cos(degrees * deg2rad);
+        sinMaxTurnAngle = std::sin(degrees * deg2rad);
+    }
+
+    // Pointers to this fish's joints in the joint store. Only valid until joints are added to the store.
+    glm::vec2 *pointData() { return joints->points.data() + jointOffset; }
+    const glm::vec2 *pointData() const { return joints->points.data() + jointOffset; }
+    float *sizeData() { return joints->sizes.data() + jointOffset; }
+    glm::vec2 *forwardData() { return joints->forwards.data() + jointOffset; } // jointForward(i) for every joint
+    float *angleData() { return joints->angles.data() + jointOffset; }         // jointAngle(i) for every joint (the first is 0)
 
     // Set the head of the fish to pos and constrain fish
     void setHeadPosition(glm::vec2 pos)
     {
-        points[0] = pos;
+        pointData()[0] = pos;
         constrain();
     }
 
@@ -101,25 +204,50 @@ struct Fish
     // Add a joint to the end of a fish
     void addJoint(glm::vec2 pos, float size)
     {
-        points.push_back(pos);
-        sizes.push_back(size);
+        jointOffset = joints->append(jointOffset, jointCount, pos, size);
+        jointCount++;
         constrain();
-        if (size > finSize)
+        if (jointCount > 1 && size > finSize)
         {
-            finIndex = points.size() - 1;
+            finIndex = jointCount - 1;
             finSize = size;
         }
     }
 
+    // Put the side fins on the widest joint behind the head
+    void placeFins()
+    {
+        const float *sizes = sizeData();
+        finIndex = 1;
+        finSize = FLT_MIN;
+        for (int i = 1; i < jointCount; i++) // The head can't have fins, render angles them by the joint in front
+        {
+            if (sizes[i] > finSize)
+            {
+                finIndex = i;
+                finSize = sizes[i];
+            }
+        }
+    }
+
     // Update the fish joint positions based on the forward direction and the delta time
     void update(float dt)
     {
-        // Move fish forward
-        forward = glm::normalize(forward);
-        points[0] += forward * moveSpeed * dt;
+        move(dt);
 
         // Constrain other joints
         constrain();
+    }
+
+    // Move the head forward and update the hook timer, without constraining the other joints.
+    // Used by Flock, which constrains every fish together afterwards.
+    void move(float dt)
+    {
+        // Move fish forward
+        forward = glm::normalize(forward);
+        pointData()[0] += forward * moveSpeed * dt;
+        forwardsValid = false;
+        anglesValid = false;
 
         // Update hook stuff
         if (hooked)
@@ -132,83 +260,115 @@ struct Fish
         }
     }
 
-    // Constrain points based on linkDistance & turnAngle
+    // Constrain points based on linkDistance & turnAngle.
+    // The bend of each joint is measured with a dot product (cos) and a cross product (sin), so there are no atan2/sin/cos calls.
+    // Common joint counts use a version of the loop unrolled at compile time (see constrainJoints).
     void constrain()
     {
-        for (int i = 1; i < points.size(); i++)
+        anglesValid = false;
+        if (jointCount < 2)
         {
-            // Constrain distance
-            glm::vec2 diff = glm::normalize(points[i] - points[i - 1]);
-            points[i] = points[i - 1] + diff * linkDistance;
+            forwardsValid = false;
+            return;
+        }
+
+        constrainJoints(pointData(), forwardData(), jointCount, -glm::normalize(forward), linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+        forwardsValid = true;
+    }
 
-            // Constrain angle
-            float angle = jointAngle(i);
-            angle = std::clamp(angle, -maxTurnAngle, maxTurnAngle);
-            diff = -jointForward(i - 1);
-            diff = rotate(diff, angle);
-            points[i] = points[i - 1] + diff * linkDistance;
+    // Work out the parts of the skeleton cache that are out of date
+    void updateSkeleton()
+    {
+        if (jointCount == 0)
+            return;
+
+        glm::vec2 *points = pointData();
+        glm::vec2 *forwards = forwardData();
+        if (!forwardsValid)
+        {
+            forwards[0] = glm::normalize(forward);
+            for (int i = 1; i < jointCount; i++)
+            {
+                forwards[i] = glm::normalize(points[i - 1] - points[i]);
+            }
+            skeletonMathCalls += jointCount;
+            forwardsValid = true;
+        }
+
+        if (!anglesValid)
+        {
+            float *angles = angleData();
+            float angle = 0.0f;
+            angles[0] = 0.0f;
+            for (int i = 1; i < jointCount; i++)
+            {
+                angles[i] = getAngle(forwards[i - 1], forwards[i]);
+                angle += angles[i];
+            }
+            skeletonMathCalls += jointCount - 1;
+            cachedCurvature = jointCount < 2 ? 0.0f : angle / ((jointCount - 1) * maxTurnAngle);
+            anglesValid = true;
         }
     }
 
     // Get the unit forward direction for the joint at jointIndex
     glm::vec2 jointForward(int jointIndex)
     {
-        if (jointIndex == 0)
-        {
-            return glm::normalize(forward);
-        }
-        return glm::normalize(points[jointIndex - 1] - points[jointIndex]);
+        updateSkeleton();
+        return forwardData()[jointIndex];
     }
 
     // Get the position on the left side of the point at index jointIndex based on the size at index jointIndex
     glm::vec2 jointLeft(int jointIndex)
     {
-        return rotate(jointForward(jointIndex) * sizes[jointIndex], -90) + points[jointIndex];
+        glm::vec2 side = jointForward(jointIndex) * sizeData()[jointIndex];
+        return glm::vec2(side.y, -side.x) + pointData()[jointIndex]; // Rotated -90 degrees
     }
 
     // Get the position on the right side of the point at index jointIndex based on the size at index jointIndex
     glm::vec2 jointRight(int jointIndex)
     {
-        return rotate(jointForward(jointIndex) * sizes[jointIndex], 90) + points[jointIndex];
+        glm::vec2 side = jointForward(jointIndex) * sizeData()[jointIndex];
+        return glm::vec2(-side.y, side.x) + pointData()[jointIndex]; // Rotated 90 degrees
     }
 
     // Return the angle of the point at index jointIndex
     float jointAngle(int jointIndex)
     {
-        float angle = getAngle(jointForward(jointIndex - 1), jointForward(jointIndex));
-        return angle;
+        updateSkeleton();
+        return angleData()[jointIndex];
     }
 
     // Returns the curvature of the fish in range [-1, 1]
     float curvature()
     {
-        float angle = 0.0f;
-        for (int i = 1; i < points.size(); i++)
-        {
-            angle += jointAngle(i);
-        }
-        return angle / ((points.size() - 1) * maxTurnAngle);
+        updateSkeleton();
+        return cachedCurvature;
     }
 
     // Render the fish
-    void render(sf::RenderWindow &window)
+    void render(sf::RenderWindow &window, const FishAppearance &appearance)
     {
-        if (points.size() < 2)
+        if (jointCount < 2)
             return;
 
+        const glm::vec2 *points = pointData();
+        const float *sizes = sizeData();
+
         // Draw outline
         std::vector<glm::vec2> outlinePoints;
+        outlinePoints.reserve(2 * jointCount + 2);
 
         // Add points on head
         outlinePoints.push_back(rotate(forward * sizes[0], 30) + points[0]);
         outlinePoints.push_back(rotate(forward * sizes[0], 90) + points[0]);
 
         // Add other points (in order going around)
-        for (int i = 1; i < points.size(); ++i)
+        for (int i = 1; i < jointCount; ++i)
         {
             outlinePoints.push_back(jointRight(i));
         }
-        for (int i = points.size() - 1; i > 0; i--)
+        for (int i = jointCount - 1; i > 0; i--)
         {
             outlinePoints.push_back(jointLeft(i));
         }
@@ -221,56 +381,60 @@ struct Fish
         float bodyAngle = curvature();
         glm::vec2 finRight = jointRight(finIndex);
         float rightRotation = getRotation(jointRight(finIndex - 1) - finRight);
+        skeletonMathCalls += 2; // This and leftRotation
         drawEllipse(window,
                     {finRight.x, finRight.y},
                     {finSize * 0.75f, finSize * 0.75f * 0.5f},
-                    rightRotation - normalFinRotation - bodyAngle * turnFinRotation,
-                    finColor);
+                    rightRotation - appearance.normalFinRotation - bodyAngle * appearance.turnFinRotation,
+                    appearance.finColor);
 
         glm::vec2 finLeft = jointLeft(finIndex);
         float leftRotation = getRotation(jointLeft(finIndex - 1) - finLeft);
         drawEllipse(window,
                     {finLeft.x, finLeft.y},
                     {finSize * 0.75f, finSize * 0.75f * 0.5f},
-                    leftRotation + normalFinRotation - bodyAngle * turnFinRotation,
-                    finColor);
+                    leftRotation + appearance.normalFinRotation - bodyAngle * appearance.turnFinRotation,
+                    appearance.finColor);
 
         // Render tail fin
-        int lastIdx = points.size() - 1;
+        int lastIdx = jointCount - 1;
         glm::vec2 lastPoint = points[lastIdx];
         glm::vec2 tailPoint = lastPoint - jointForward(lastIdx) * linkDistance;
         glm::vec2 tailMovePoint = tailPoint + (jointRight(lastIdx) - lastPoint) * 3.0f * curvature();
         drawSmoothFillConvex(
             {lastPoint, tailPoint, tailMovePoint},
             window,
-            tailColor);
+            appearance.tailColor);
         drawSmoothLine({lastPoint, tailPoint, tailMovePoint}, window, true);
 
         // Render body
-        drawSmoothFillTube(outlinePoints, window, bodyColor);
+        drawSmoothFillTube(outlinePoints, window, appearance.bodyColor);
         drawSmoothLine(outlinePoints, window, true); // Body outline
 
         // Render eyes
         glm::vec2 rightEyePos = rotate(forward * sizes[0] * 0.5f, 90) + points[0];
         glm::vec2 leftEyePos = rotate(forward * sizes[0] * 0.5f, -90) + points[0];
         sf::CircleShape circle;
-        circle.setRadius(eyeRadius);
-        circle.setFillColor(eyeColor);
-        circle.setOrigin(eyeRadius, eyeRadius);
+        circle.setRadius(appearance.eyeRadius);
+        circle.setFillColor(appearance.eyeColor);
+        circle.setOrigin(appearance.eyeRadius, appearance.eyeRadius);
         circle.setPosition({rightEyePos.x, rightEyePos.y});
         window.draw(circle);
         circle.setPosition({leftEyePos.x, leftEyePos.y});
         window.draw(circle);
 
-        // Render dorsal fin
-        drawSmoothLine({points[1], points[2], points[3]}, window, false);                                                    // Base
-        drawSmoothLine({points[1], points[2] + (jointRight(2) - points[2]) * curvature() * 1.0f, points[3]}, window, false); // Top
+        // Render dorsal fin. It spans joints 1 to 3, so shorter bodies go without.
+        if (jointCount >= 4)
+        {
+            drawSmoothLine({points[1], points[2], points[3]}, window, false);                                                    // Base
+            drawSmoothLine({points[1], points[2] + (jointRight(2) - points[2]) * curvature() * 1.0f, points[3]}, window, false); // Top
+        }
     }
 
     // Get the position of the fish's head
     glm::vec2 getHeadPosition() const
     {
-        return points.empty() ? glm::vec2(0.0f) : points[0];
+        return jointCount == 0 ? glm::vec2(0.0f) : pointData()[0];
     }
 };
 
@@ -300,10 +464,215 @@ struct Affector
     }
 };
 
+// The attractors or the repellors of a flock. Removing one moves the last into its place, so expiring is O(1) per affector.
+// Once there are many, they are indexed with a spatial grid so each fish only checks the ones near it,
+// and once there are hundreds, they are rasterized into an influence map so each fish takes one sample instead.
+struct AffectorList
+{
+    std::vector<Affector> items;
+    int gridThreshold = 32; // Use the grid from this many affectors on. Below it, checking every affector is faster than a grid lookup.
+    int mapThreshold = 256; // Use the influence map from this many affectors on
+    float mapCellSize = 0.25f;
+
+    SpatialGrid grid;
+    std::vector<float> xs; // Positions of the affectors, for building the grid
+    std::vector<float> ys;
+    bool gridDirty = true; // Set when affectors are added or removed
+    float gridRadius = 0.0f;
+
+    InfluenceMap map;
+    bool mapDirty = true;
+    float mapRadius = 0.0f;
+    glm::vec2 mapMin = {0.0f, 0.0f}; // Area the map was built over
+    glm::vec2 mapMax = {0.0f, 0.0f};
+
+    void add(const Affector &affector)
+    {
+        items.push_back(affector);
+        gridDirty = true;
+        mapDirty = true;
+    }
+
+    bool usesMap() const { return items.size() >= (size_t)mapThreshold; }
+
+    // Count down the lifetimes, removing affectors that have run out
+    void update(float dt)
+    {
+        for (size_t i = 0; i < items.size();)
+        {
+            items[i].update(dt);
+            if (items[i].finished())
+            {
+                items[i] = items.back();
+                items.pop_back();
+                gridDirty = true;
+                mapDirty = true;
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    // Rebuild the grid or the map over the area from areaMin to areaMax, if affectors were added or removed since it was built.
+    // Must be called before sumDirections, outside of any parallel loop.
+    void buildIndex(float radius, glm::vec2 areaMin, glm::vec2 areaMax)
+    {
+        if (usesMap())
+        {
+            if (!mapDirty && radius == mapRadius && areaMin == mapMin && areaMax == mapMax)
+                return;
+
+            map.reset(areaMin, areaMax, mapCellSize);
+            for (const Affector &affector : items)
+            {
+                map.add(affector.pos, radius, 1.0f);
+            }
+            mapDirty = false;
+            mapRadius = radius;
+            mapMin = areaMin;
+            mapMax = areaMax;
+            return;
+        }
+
+        if (items.size() < (size_t)gridThreshold || (!gridDirty && radius == gridRadius))
+            return;
+
+        xs.resize(items.size());
+        ys.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            xs[i] = items[i].pos.x;
+            ys[i] = items[i].pos.y;
+        }
+        grid.build(xs.data(), ys.data(), items.size(), radius);
+        gridDirty = false;
+        gridRadius = radius;
+    }
+
+    // Sum of the unit directions from pos towards every affector within radius of it.
+    // With the influence map this is interpolated from the nearest map nodes, and radius has to match the one the map was built with.
+    glm::vec2 sumDirections(glm::vec2 pos, float radius) const
+    {
+        if (usesMap())
+            return map.sample(pos);
+
+        glm::vec2 sum(0.0f);
+        auto addAffector = [&](const Affector &affector)
+        {
+            glm::vec2 diff = affector.pos - pos;
+            if (glm::length(diff) < radius)
+                sum += glm::normalize(diff);
+        };
+
+        if (items.size() < (size_t)gridThreshold)
+        {
+            for (const Affector &affector : items)
+            {
+                addAffector(affector);
+            }
+        }
+        else
+        {
+            grid.forEachNear(pos, radius, [&](uint32_t i)
+                             { addAffector(items[i]); });
+        }
+        return sum;
+    }
+};
+
+// Per-fish values read by the boids loops, stored as one contiguous array per value (structure of arrays) so neighbor loops stay in cache.
+// Index i holds the values for Flock::allFish[i].
+struct FlockState
+{
+    // Bits stored in flags
+    static constexpr uint8_t hookedFlag = 1 << 0;
+    static constexpr uint8_t pulledFlag = 1 << 1;
+
+    std::vector<float> headX;
+    std::vector<float> headY;
+    std::vector<float> forwardX;
+    std::vector<float> forwardY;
+    std::vector<uint8_t> flags;
+
+    size_t size() const
+    {
+        return headX.size();
+    }
+
+    void resize(size_t count)
+    {
+        headX.resize(count);
+        headY.resize(count);
+        forwardX.resize(count);
+        forwardY.resize(count);
+        flags.resize(count);
+    }
+
+    // Copy the values of fish into index i
+    void set(size_t i, const Fish &fish)
+    {
+        glm::vec2 head = fish.getHeadPosition();
+        headX[i] = head.x;
+        headY[i] = head.y;
+        forwardX[i] = fish.forward.x;
+        forwardY[i] = fish.forward.y;
+        flags[i] = (fish.hooked ? hookedFlag : 0) | (fish.pulled ? pulledFlag : 0);
+    }
+
+    glm::vec2 head(size_t i) const
+    {
+        return {headX[i], headY[i]};
+    }
+
+    glm::vec2 forward(size_t i) const
+    {
+        return {forwardX[i], forwardY[i]};
+    }
+};
+
+// What is left of a fish after it is caught, passed to FishBook::update
+struct CatchRecord
+{
+    uint16_t typeId;    // ID of the fish's type in the flock's FishTypeRegistry
+    float size;         // Length of the fish's body
+    glm::vec2 position; // Where its head was when it was landed
+};
+
+// The fish of a flock copied out of it, so they can be drawn while the flock keeps stepping (see SimThread).
+// The joints are interpolated between the flock's last two steps. Filled by Flock::takeSnapshot.
+struct FlockSnapshot
+{
+    std::vector<Fish> fish; // Copies of the flock's fish, with their joints in the store below
+    JointStore joints;
+
+    // Draw every fish. Only the fish appearances are read from types, which don't change once the flock is running.
+    void render(sf::RenderWindow &window, const FishTypeRegistry &types)
+    {
+        for (Fish &drawn : fish)
+        {
+            drawn.render(window, types.appearances[drawn.typeId]);
+        }
+    }
+};
+
+// The unweighted separation, alignment and cohesion directions for one fish
+struct BoidsSteering
+{
+    glm::vec2 separation = {0.0f, 0.0f};
+    glm::vec2 alignment = {0.0f, 0.0f};
+    glm::vec2 cohesion = {0.0f, 0.0f};
+};
+
 struct Flock
 {
-    std::vector<std::unique_ptr<Fish>> allFish;
-    std::vector<Affector> affectors;
+    std::vector<Fish> allFish;
+    JointStore joints;          // Joints of every fish, see Fish::jointOffset
+    FishTypeRegistry fishTypes; // Types the fish in the flock can be, see Fish::typeId
+    FlockState state;           // Hot copy of each fish's head, heading and flags for the boids loops
+    AffectorList attractors;
+    AffectorList repellors;
 
     float hookDist = 1.0f;
 
@@ -322,17 +691,347 @@ struct Flock
 
     float delta = 0.999f; // How much of the current velocity is maintained
 
+    // Neighbor search
+    bool useSpatialGrid = true; // If false, every fish checks every other fish (brute force). Kept for comparing against the grid. Also applies to building the neighbor lists.
+    SpatialGrid grid;
+    std::vector<uint32_t> allIndices;                       // 0 to allFish.size() - 1, the candidate list for brute force search
+    std::vector<uint32_t> candidates;                       // Scratch list of the fish in the grid cells around the fish being gathered for
+    NeighborKernel neighborKernel = selectNeighborKernel(); // SIMD kernel for the fastest instruction set the CPU supports. Set to accumulateNeighborsScalar to compare.
+
+    // Cached (Verlet) neighbor lists. Each fish keeps a list of the fish within the largest boids radius + neighborSkin, which stays valid until some fish has moved more than neighborSkin / 2.
+    bool useNeighborLists = true;
+    float neighborSkin = 0.5f;
+    std::vector<uint32_t> neighborStart; // neighborList[neighborStart[i]] to neighborList[neighborStart[i + 1] - 1] are the neighbors of fish i
+    std::vector<uint32_t> neighborList;
+    std::vector<float> listHeadX; // Head positions when the lists were last built
+    std::vector<float> listHeadY;
+    float listRadius = 0.0f;        // Radius the lists were last built with
+    bool neighborListsDirty = true; // Set when fish are added or removed, since that changes the indices
+    int neighborListRebuilds = 0;   // Number of times the lists have been rebuilt, useful for tuning neighborSkin
+
+    // Barnes-Hut approximation for cohesion and alignment, so large cohesionRadius/alignmentRadius values stay cheap in dense schools.
+    // Separation still uses the exact neighbor search above.
+    bool useBarnesHut = false;
+    float barnesHutTheta = 0.3f; // Opening angle. A group of fish is used as one neighbor if its size / distance is below this. 0 is exact.
+    QuadTree quadTree;
+
+    // Fish handles. allFish is kept dense (removing a fish moves the last fish into its place), so anything that needs to remember a fish keeps its handle.
+    SlotMap fishSlots;             // Index in allFish of the fish with each handle
+    std::vector<CatchRecord> catches; // Fish removed by the last finishPull
+
+    // Memory order. Fish are periodically sorted by the Morton code of their head so fish that are close in the pond are close in memory.
+    int reorderInterval = 250; // Reorder every this many steps. 0 disables reordering.
+    std::vector<std::pair<uint32_t, uint32_t>> reorderKeys; // Scratch (Morton code, old index) pairs
+    std::vector<Fish> reorderFish;                          // Scratch storage while reordering
+
+    // Topological neighbors. Real schools react to a fixed number of nearest fish rather than everything in a radius, which also keeps the cost per fish flat as the school gets denser.
+    int topologicalNeighbors = 0; // If above 0, alignment and cohesion use this many nearest fish (and separation the ones of those within separationRadius) instead of the radii. At most KdTree::maxK.
+    KdTree kdTree;
+
+    // Body solver. After every fish has moved, the joint constraints of all fish are solved together, with fish as SIMD lanes.
+    // The batches also hand back every joint's forward direction, so the skeleton cache stays filled just like with Fish::constrain.
+    bool batchedConstrain = true;
+    ConstrainKernel constrainKernel = selectConstrainKernel(); // Set to constrainBatchScalar to compare
+    std::vector<std::vector<uint32_t>> fishByJointCount;       // fishByJointCount[n] holds the indices of the fish with n joints
+    std::vector<std::pair<uint32_t, uint32_t>> constrainBatches; // (joint count, first position in fishByJointCount[joint count]) of each batch
+    std::vector<BodyBatch> threadBatches;                        // Per-thread batch scratch
+
+    // Steering rate
+    int steeringInterval = 1; // Recalculate each fish's desired direction every this many steps, holding it in between. Fish are staggered so the same share of them steer every step.
+    uint64_t stepCount = 0;   // Number of steps taken, used to pick which fish steer
+
+    // Multithreading
+    bool parallelStep = false;                           // If true, step() splits the fish across a thread pool. Every fish steers from the previous step's headings, so the result doesn't depend on the thread count.
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::unique_ptr<ThreadPool> threadPool;              // Created the first time a parallel step runs
+    std::vector<std::vector<uint32_t>> threadCandidates; // Per-thread version of candidates
+    std::vector<float> nextForwardX;                     // Headings written by the parallel step, swapped into the flock state once every fish has steered
+    std::vector<float> nextForwardY;
+
+    // Simulation level of detail. Fish outside the view (see setView) are only stepped on every lodInterval-th step, with lodInterval times the dt.
+    // They take turns, so the same share of them is stepped every step. Hooked fish are always stepped.
+    int lodInterval = 4;                         // 1 steps every fish every step
+    float lodMargin = 1.0f;                      // Fish this close to the view count as visible, so fish swimming into view are already at full detail
+    glm::vec2 viewMin = {-FLT_MAX, -FLT_MAX};    // Visible area. Everything is visible until setView is called.
+    glm::vec2 viewMax = {FLT_MAX, FLT_MAX};
+    std::vector<uint8_t> fishSteps;              // Number of steps' worth of time each fish moves this step, 0 if it is skipped
+    size_t lodSkippedFish = 0;                   // Number of fish skipped on the last step
+
     // World bounds for containing the flock
     float worldWidth = 20.0f;
     float worldHeight = 10.0f;
 
+    // Pond shape. Baked into a signed distance field whenever it or the world bounds change, so fish can find the nearest shore in O(1).
+    PondShape pond;
+    SignedDistanceField pondField;
+    float pondFieldCellSize = 0.1f;
+    float pondFieldMargin = 1.0f; // How far past the world bounds the field reaches
+
     uint32_t randSeed;
     float fixedDt;
     float accumulatedDt = 0.0f;
 
+    // Fixed step catch-up. After a long frame (a hitch, or the window being dragged) at most maxSubsteps steps are taken and the rest of the time is dropped,
+    // so a slow frame can't make the next one slower still. With interpolateRender, fish are drawn between their last two steps so a low fixed rate still moves smoothly.
+    int maxSubsteps = 50;
+    float droppedSimTime = 0.0f;  // Total seconds of simulation dropped because of maxSubsteps
+    bool interpolateRender = true;
+    FlockSnapshot renderSnapshot; // Interpolated fish drawn by render
+
     Flock(uint32_t _randSeed, float _fixedDt)
         : randSeed(_randSeed),
-          fixedDt(_fixedDt) {}
+          fixedDt(_fixedDt)
+    {
+        bakePond();
+    }
+
+    // Get the fish with the given handle, or nullptr if it isn't in the flock anymore
+    Fish *getFish(Handle handle)
+    {
+        int index = fishSlots.find(handle);
+        return index < 0 ? nullptr : &allFish[index];
+    }
+
+    // Remove the fish at index by moving the last fish into its place
+    void removeFish(uint32_t index)
+    {
+        const Fish &removed = allFish[index];
+        fishSlots.remove(removed.handle);
+        joints.release(removed.jointOffset, removed.jointCount);
+
+        if (index != allFish.size() - 1)
+        {
+            allFish[index] = std::move(allFish.back());
+            fishSlots.setIndex(allFish[index].handle, index);
+        }
+        allFish.pop_back();
+        neighborListsDirty = true;
+    }
+
+    // Sort the fish by the Morton code of their head position
+    void reorderByMortonCode()
+    {
+        if (allFish.size() < 2)
+            return;
+
+        // Quantize the heads to 16 bits per axis over the area the fish are in
+        glm::vec2 minPos = allFish[0].getHeadPosition();
+        glm::vec2 maxPos = minPos;
+        for (const Fish &fish : allFish)
+        {
+            glm::vec2 head = fish.getHeadPosition();
+            minPos = {std::min(minPos.x, head.x), std::min(minPos.y, head.y)};
+            maxPos = {std::max(maxPos.x, head.x), std::max(maxPos.y, head.y)};
+        }
+        glm::vec2 scale = {65535.0f / std::max(maxPos.x - minPos.x, 1e-6f), 65535.0f / std::max(maxPos.y - minPos.y, 1e-6f)};
+
+        reorderKeys.resize(allFish.size());
+        for (uint32_t i = 0; i < allFish.size(); i++)
+        {
+            glm::vec2 cell = (allFish[i].getHeadPosition() - minPos) * scale;
+            reorderKeys[i] = {mortonCode((uint16_t)cell.x, (uint16_t)cell.y), i};
+        }
+        std::sort(reorderKeys.begin(), reorderKeys.end());
+
+        // Move the fish into their new order
+        reorderFish.clear();
+        for (const auto &key : reorderKeys)
+        {
+            reorderFish.push_back(std::move(allFish[key.second]));
+        }
+        allFish.swap(reorderFish);
+
+        for (uint32_t i = 0; i < allFish.size(); i++)
+        {
+            fishSlots.setIndex(allFish[i].handle, i);
+        }
+        neighborListsDirty = true;
+
+        // Put the joints in the same order
+        compactJoints();
+    }
+
+    // Rewrite the joint store in the order of allFish, dropping the holes left by removed fish
+    void compactJoints()
+    {
+        joints.beginCompact();
+        for (Fish &fish : allFish)
+        {
+            fish.jointOffset = joints.keep(fish.jointOffset, fish.jointCount);
+        }
+        joints.endCompact();
+    }
+
+    // Copy every fish into the flock state
+    void syncState()
+    {
+        state.resize(allFish.size());
+        allIndices.resize(allFish.size());
+        for (size_t i = 0; i < allFish.size(); i++)
+        {
+            state.set(i, allFish[i]);
+            allIndices[i] = i;
+        }
+    }
+
+    // Radius the grid and neighbor lists have to cover. With Barnes-Hut the quad tree handles alignment and cohesion, so only separation is searched.
+    float neighborSearchRadius() const
+    {
+        if (useBarnesHut && topologicalNeighbors <= 0)
+            return separationRadius;
+        return std::max({separationRadius, alignmentRadius, cohesionRadius});
+    }
+
+    // Rebuild the spatial grid from the head positions in the flock state. Cells are the size of the search radius so a query only has to visit nearby cells.
+    void buildGrid()
+    {
+        grid.build(state.headX.data(), state.headY.data(), state.size(), neighborSearchRadius());
+    }
+
+    // Returns true if the neighbor lists no longer cover every fish within the search radius
+    bool neighborListsExpired()
+    {
+        if (neighborListsDirty || listHeadX.size() != state.size() || listRadius != neighborSearchRadius() + neighborSkin)
+            return true;
+
+        // Two fish can close the gap between them by at most twice the largest distance any fish has moved
+        float maxMove2 = 0.25f * neighborSkin * neighborSkin;
+        for (size_t i = 0; i < state.size(); i++)
+        {
+            float dx = state.headX[i] - listHeadX[i];
+            float dy = state.headY[i] - listHeadY[i];
+            if (dx * dx + dy * dy > maxMove2)
+                return true;
+        }
+        return false;
+    }
+
+    // Rebuild the neighbor list of every fish, from the spatial grid or, with useSpatialGrid off, by checking every pair of fish
+    void buildNeighborLists()
+    {
+        listRadius = neighborSearchRadius() + neighborSkin;
+        float listRadius2 = listRadius * listRadius;
+        if (useSpatialGrid)
+        {
+            grid.build(state.headX.data(), state.headY.data(), state.size(), listRadius);
+        }
+
+        neighborStart.resize(state.size() + 1);
+        neighborList.clear();
+        for (uint32_t i = 0; i < state.size(); i++)
+        {
+            neighborStart[i] = neighborList.size();
+            glm::vec2 pos = state.head(i);
+            auto addIfNear = [&](uint32_t other)
+            {
+                glm::vec2 diff = pos - state.head(other);
+                if (other != i && glm::dot(diff, diff) < listRadius2)
+                {
+                    neighborList.push_back(other);
+                }
+            };
+
+            if (useSpatialGrid)
+            {
+                grid.forEachNear(pos, listRadius, addIfNear);
+            }
+            else
+            {
+                for (uint32_t other = 0; other < state.size(); other++)
+                {
+                    addIfNear(other);
+                }
+            }
+        }
+        neighborStart[state.size()] = neighborList.size();
+
+        listHeadX = state.headX;
+        listHeadY = state.headY;
+        neighborListsDirty = false;
+        neighborListRebuilds++;
+    }
+
+    // Get the indices of every fish that could be within radius of pos as one contiguous list, so a SIMD kernel can run over all of them at once.
+    // The list is built in scratch unless every fish is a candidate.
+    const std::vector<uint32_t> &findCandidates(glm::vec2 pos, float radius, std::vector<uint32_t> &scratch)
+    {
+        if (!useSpatialGrid)
+        {
+            return allIndices;
+        }
+
+        scratch.clear();
+        grid.forEachCellNear(pos, radius, [&](const uint32_t *entries, int count)
+                             { scratch.insert(scratch.end(), entries, entries + count); });
+        return scratch;
+    }
+
+    // Gather the separation, alignment and cohesion totals for the fish at fishIndex in one pass over its neighbors.
+    // Reads only the flock state, and the candidates are handed to the SIMD neighbor kernel in one call.
+    NeighborSums gatherNeighbors(uint32_t fishIndex, std::vector<uint32_t> &scratch)
+    {
+        NeighborQuery query;
+        query.headX = state.headX.data();
+        query.headY = state.headY.data();
+        query.forwardX = state.forwardX.data();
+        query.forwardY = state.forwardY.data();
+        query.self = fishIndex;
+        query.pos = state.head(fishIndex);
+        query.separationRadius2 = separationRadius * separationRadius;
+        query.alignmentRadius2 = alignmentRadius * alignmentRadius;
+        query.cohesionRadius2 = cohesionRadius * cohesionRadius;
+
+        NeighborSums sums;
+        if (topologicalNeighbors > 0)
+        {
+            kdTree.findNearest(query.pos, topologicalNeighbors, fishIndex, scratch);
+            query.alignmentRadius2 = FLT_MAX;
+            query.cohesionRadius2 = FLT_MAX;
+            neighborKernel(query, scratch.data(), (int)scratch.size(), sums);
+            return sums;
+        }
+        if (useBarnesHut)
+        {
+            // The quad tree handles the long range rules, the neighbor search only has to find separation
+            quadTree.accumulate(query.pos, fishIndex, alignmentRadius, cohesionRadius, barnesHutTheta, sums);
+            query.alignmentRadius2 = 0.0f;
+            query.cohesionRadius2 = 0.0f;
+        }
+
+        if (useNeighborLists)
+        {
+            uint32_t start = neighborStart[fishIndex];
+            neighborKernel(query, neighborList.data() + start, (int)(neighborStart[fishIndex + 1] - start), sums);
+            return sums;
+        }
+
+        const std::vector<uint32_t> &found = findCandidates(query.pos, neighborSearchRadius(), scratch);
+        neighborKernel(query, found.data(), (int)found.size(), sums);
+        return sums;
+    }
+
+    // Turn neighbor totals into the same directions calculateSeparation, calculateAlignment and calculateCohesion return
+    BoidsSteering finishSteering(const NeighborSums &sums, glm::vec2 pos)
+    {
+        BoidsSteering steering;
+        if (sums.separationCount > 0)
+        {
+            steering.separation = sums.separation / static_cast<float>(sums.separationCount);
+        }
+        if (sums.alignmentCount > 0)
+        {
+            steering.alignment = glm::normalize(sums.alignment / static_cast<float>(sums.alignmentCount));
+        }
+        if (sums.cohesionCount > 0)
+        {
+            glm::vec2 center = sums.cohesion / static_cast<float>(sums.cohesionCount);
+            steering.cohesion = glm::normalize(center - pos);
+        }
+        return steering;
+    }
+
+    // Reference versions of the three boids rules, one fish at a time. They check every fish in allFish rather than the search structures,
+    // so they are exact whatever mode the flock is in, and are what the neighbor kernels are checked against (see fluidSim/resources/testScripts/boidsKernelCheck.cpp).
 
     // Calculate the direction a fish should move to move away from other fish that are too close (within the separationRadius)
     glm::vec2 calculateSeparation(const Fish &fish)
@@ -340,12 +1039,12 @@ struct Flock
         glm::vec2 separation(0.0f);
         int count = 0;
 
-        for (const auto &other : allFish)
+        for (const Fish &other : allFish)
         {
-            if (other.get() == &fish)
+            if (&other == &fish)
                 continue;
 
-            glm::vec2 diff = fish.getHeadPosition() - other->getHeadPosition();
+            glm::vec2 diff = fish.getHeadPosition() - other.getHeadPosition();
             float distance = glm::length(diff);
 
             if (distance < separationRadius && distance > 0)
@@ -369,16 +1068,16 @@ struct Flock
         glm::vec2 averageVelocity(0.0f);
         int count = 0;
 
-        for (const auto &other : allFish)
+        for (const Fish &other : allFish)
         {
-            if (other.get() == &fish)
+            if (&other == &fish)
                 continue;
 
-            float distance = glm::length(fish.getHeadPosition() - other->getHeadPosition());
+            float distance = glm::length(fish.getHeadPosition() - other.getHeadPosition());
 
             if (distance < alignmentRadius)
             {
-                averageVelocity += other->forward;
+                averageVelocity += other.forward;
                 count++;
             }
         }
@@ -398,16 +1097,16 @@ struct Flock
         glm::vec2 center(0.0f);
         int count = 0;
 
-        for (const auto &other : allFish)
+        for (const Fish &other : allFish)
         {
-            if (other.get() == &fish)
+            if (&other == &fish)
                 continue;
 
-            float distance = glm::length(fish.getHeadPosition() - other->getHeadPosition());
+            float distance = glm::length(fish.getHeadPosition() - other.getHeadPosition());
 
             if (distance < cohesionRadius)
             {
-                center += other->getHeadPosition();
+                center += other.getHeadPosition();
                 count++;
             }
         }
@@ -421,51 +1120,49 @@ struct Flock
         return glm::vec2(0.0f);
     }
 
-    // Calculate the direction a fish should move to avoid boundaries
+    // Steer away from the nearest land (the shore, rocks and docks) once closer to it than the margin
     glm::vec2 calculateBoundaryAvoidance(const Fish &fish)
     {
-        glm::vec2 avoidance(0.0f);
         float margin = std::min(worldWidth * 0.1f, worldHeight * 0.1f);
         glm::vec2 pos = fish.getHeadPosition();
 
-        if (pos.x < -worldWidth / 2 + margin)
-            avoidance.x += 1.0f;
-        if (pos.x > worldWidth / 2 - margin)
-            avoidance.x -= 1.0f;
-        if (pos.y < -worldHeight / 2 + margin)
-            avoidance.y += 1.0f;
-        if (pos.y > worldHeight / 2 - margin)
-            avoidance.y -= 1.0f;
-
-        if (glm::length(avoidance) > 0)
+        if (pondField.sample(pos) < margin)
         {
-            avoidance = glm::normalize(avoidance);
+            return pondField.gradient(pos);
         }
 
-        return avoidance;
+        return glm::vec2(0.0f);
     }
 
-    glm::vec2 calculateAttractorInfluence(const Fish &fish)
+    // Push a head that ended up on land back to the water's edge. Hooked fish go where the rod takes them.
+    void containHead(Fish &fish)
     {
-        glm::vec2 influence(0.0f);
-        bool influenced = false;
-        glm::vec2 fishPos = fish.getHeadPosition();
+        if (fish.hooked)
+            return;
 
-        for (const Affector affector : affectors)
+        glm::vec2 &head = fish.pointData()[0];
+        float distance = pondField.sample(head);
+        if (distance < 0.0f)
         {
-            if (!affector.attractor)
-            {
-                continue;
-            }
-            glm::vec2 diff = affector.pos - fishPos;
-            if (glm::length(diff) < attractorRadius)
-            {
-                influence += glm::normalize(diff);
-                influenced = true;
-            }
+            head -= pondField.gradient(head) * distance;
+        }
+    }
+
+    // Move a fish and keep its head in the water, then constrain its body unless constrainAll is going to
+    void moveFish(Fish &fish, float dt)
+    {
+        fish.move(dt);
+        containHead(fish);
+        if (!batchedConstrain)
+        {
+            fish.constrain();
         }
+    }
 
-        if (influenced > 0)
+    glm::vec2 calculateAttractorInfluence(const Fish &fish)
+    {
+        glm::vec2 influence = attractors.sumDirections(fish.getHeadPosition(), attractorRadius);
+        if (glm::length(influence) > 0)
         {
             return glm::normalize(influence);
         }
@@ -473,27 +1170,11 @@ struct Flock
         return glm::vec2(0.0f);
     }
 
+    // Repellors reach as far as attractors (attractorRadius)
     glm::vec2 calculateRepellorInfluence(const Fish &fish)
     {
-        glm::vec2 influence(0.0f);
-        bool influenced = false;
-        glm::vec2 fishPos = fish.getHeadPosition();
-
-        for (const Affector affector : affectors)
-        {
-            if (affector.attractor)
-            {
-                continue;
-            }
-            glm::vec2 diff = affector.pos - fishPos;
-            if (glm::length(diff) < attractorRadius)
-            {
-                influence -= glm::normalize(diff);
-                influenced = true;
-            }
-        }
-
-        if (influenced > 0)
+        glm::vec2 influence = -repellors.sumDirections(fish.getHeadPosition(), attractorRadius);
+        if (glm::length(influence) > 0)
         {
             return glm::normalize(influence);
         }
@@ -501,29 +1182,56 @@ struct Flock
         return glm::vec2(0.0f);
     }
 
+    // Index the affectors for this step. Influence maps cover the pond plus the affector reach, since fish are kept inside the pond.
+    void buildAffectorIndices()
+    {
+        glm::vec2 areaMax = glm::vec2(worldWidth, worldHeight) * 0.5f + glm::vec2(attractorRadius);
+        attractors.buildIndex(attractorRadius, -areaMax, areaMax);
+        repellors.buildIndex(attractorRadius, -areaMax, areaMax);
+    }
+
     // Creates a fish with random traits, then adds it to the flock
-    // Method to add a random fish of a specific type
-    void addRandomFish(const FishType &fishType)
+    // Method to add a random fish of a specific type (an ID from fishTypes). Returns the new fish's handle.
+    Handle addRandomFish(uint16_t typeId)
     {
+        const FishType &fishType = fishTypes[typeId];
         float aspectRatio = worldWidth / worldHeight;
         float x = randFloat(randSeed) * worldHeight * aspectRatio - (worldHeight * aspectRatio / 2);
         float y = randFloat(randSeed) * worldHeight - (worldHeight / 2);
 
+        // Try somewhere else if the head would be on land
+        for (int attempt = 0; attempt < 32 && pondField.sample({x, y}) < 0.0f; attempt++)
+        {
+            x = randFloat(randSeed) * worldHeight * aspectRatio - (worldHeight * aspectRatio / 2);
+            y = randFloat(randSeed) * worldHeight - (worldHeight / 2);
+        }
+
         float headSize = fishType.headSize;
         float linkDistance = headSize * (randFloat(randSeed) * 1.0f + 1.0f) * fishType.linkDistanceMultiplier;
         float moveSpeed = fishType.moveSpeed + (randFloat(randSeed) * 1.0f - 0.5f);
 
-        auto fish = std::make_unique<Fish>(linkDistance, moveSpeed, fishType.bodyColor, fishType.finColor, fishType.tailColor, fishType.eyeColor, fishType.name);
-        fish->randSeed = PCG_Hash(randSeed); // Give each fish a unique seed
+        Fish fish(joints, linkDistance, moveSpeed, typeId);
+        fish.randSeed = PCG_Hash(randSeed); // Give each fish a unique seed
+        fish.handle = fishSlots.add(allFish.size());
 
-        // Add joints to create the fish body
-        fish->addJoint({x + 0 * linkDistance, y}, headSize);
-        fish->addJoint({x + 1 * linkDistance, y}, headSize * (4.0f / 3.0f));
-        fish->addJoint({x + 2 * linkDistance, y}, headSize);
-        fish->addJoint({x + 3 * linkDistance, y}, headSize * (2.0f / 3.0f));
-        fish->addJoint({x + 4 * linkDistance, y}, headSize * (1.0f / 3.0f));
+        // Create the fish body in a straight line, with the joint sizes from the fish type
+        fish.jointCount = fishType.jointCount;
+        fish.jointOffset = joints.allocate(fish.jointCount);
+        glm::vec2 *points = fish.pointData();
+        float *sizes = fish.sizeData();
+        for (int j = 0; j < fish.jointCount; j++)
+        {
+            points[j] = {x + j * linkDistance, y};
+            sizes[j] = fishType.jointSize(j);
+        }
+        fish.placeFins();
+        fish.constrain();
+        fish.previousForward = fish.forward;
+        std::copy(points, points + fish.jointCount, joints.previousPoints.begin() + fish.jointOffset);
 
         allFish.push_back(std::move(fish));
+        neighborListsDirty = true;
+        return allFish.back().handle;
     }
 
     // Update the flock based on the amount of time passed
@@ -532,13 +1240,22 @@ struct Flock
         accumulatedDt += dt;
         int nSteps = (int)(accumulatedDt / fixedDt);
         accumulatedDt -= nSteps * fixedDt;
+        if (nSteps > maxSubsteps)
+        {
+            droppedSimTime += (nSteps - maxSubsteps) * fixedDt;
+            nSteps = maxSubsteps;
+        }
         for (int i = 0; i < nSteps; i++)
         {
+            if (i == nSteps - 1)
+            {
+                savePreviousState();
+            }
             updateAffectors(fixedDt);
             step(fixedDt);
             if (rod.cast)
             {
-                bool hooked = hookFish(rod.pos, rod.readyToHook());
+                bool hooked = hookFish(rod);
                 if (hooked)
                 {
                     rod.timeSinceHooked = 0.0f;
@@ -547,59 +1264,321 @@ struct Flock
         }
     }
 
+    // Remember where every fish is before a step, for render to interpolate from
+    void savePreviousState()
+    {
+        joints.previousPoints = joints.points;
+        for (Fish &fish : allFish)
+        {
+            fish.previousForward = fish.forward;
+        }
+    }
+
     void updateAffectors(float dt)
     {
-        for (int i = affectors.size() - 1; i >= 0; i--)
+        attractors.update(dt);
+        repellors.update(dt);
+    }
+
+    // Calculate the direction the fish at fishIndex wants to move in by combining all of the flocking behaviors
+    glm::vec2 calculateDesiredDirection(uint32_t fishIndex, std::vector<uint32_t> &scratch)
+    {
+        const Fish &fish = allFish[fishIndex];
+
+        // Calculate flocking behaviors
+        BoidsSteering boids = finishSteering(gatherNeighbors(fishIndex, scratch), state.head(fishIndex));
+        glm::vec2 separation = boids.separation * separationWeight;
+        glm::vec2 alignment = boids.alignment * alignmentWeight;
+        glm::vec2 cohesion = boids.cohesion * cohesionWeight;
+        glm::vec2 boundaryAvoidance = calculateBoundaryAvoidance(fish) * 2.0f;
+        glm::vec2 attractorInfluence = calculateAttractorInfluence(fish) * attractorWeight;
+        glm::vec2 repellorInfluence = calculateRepellorInfluence(fish) * repellorWeight;
+
+        // Combine all behaviors
+        return separation + alignment + cohesion + boundaryAvoidance + attractorInfluence + repellorInfluence;
+    }
+
+    // Where the fish at fishIndex is in the rotations that stagger steering and off-screen steps.
+    // Keyed on the handle's slot rather than the index, since reorderByMortonCode renumbers every fish.
+    uint64_t stepPhase(size_t fishIndex) const
+    {
+        return stepCount + allFish[fishIndex].handle.slot;
+    }
+
+    // Returns true if the fish at fishIndex should recalculate its desired direction this step
+    bool steersThisStep(size_t fishIndex)
+    {
+        return steeringInterval <= 1 || stepPhase(fishIndex) % steeringInterval == 0;
+    }
+
+    // Get the new heading of a fish after steering towards desiredDirection for the given number of steps
+    glm::vec2 steer(glm::vec2 forward, glm::vec2 desiredDirection, int steps = 1)
+    {
+        if (glm::length(desiredDirection) > 0)
         {
-            Affector &affector = affectors[i];
-            affector.update(dt);
-            if (affector.finished())
+            // Adjust fish direction based on the calculated behaviors
+            float keep = steps == 1 ? delta : std::pow(delta, (float)steps);
+            return forward * keep + desiredDirection * (1 - keep);
+        }
+        return forward;
+    }
+
+    // Set the area of the pond that is on screen, for the level of detail
+    void setView(glm::vec2 center, glm::vec2 size)
+    {
+        viewMin = center - size * 0.5f;
+        viewMax = center + size * 0.5f;
+    }
+
+    // Work out how many steps' worth of time each fish moves this step (see lodInterval)
+    void assignLevelOfDetail()
+    {
+        fishSteps.resize(allFish.size());
+        lodSkippedFish = 0;
+        for (size_t i = 0; i < allFish.size(); i++)
+        {
+            glm::vec2 head = state.head(i);
+            bool visible = head.x > viewMin.x - lodMargin && head.x < viewMax.x + lodMargin &&
+                           head.y > viewMin.y - lodMargin && head.y < viewMax.y + lodMargin;
+            bool onHook = state.flags[i] & (FlockState::hookedFlag | FlockState::pulledFlag);
+            if (lodInterval <= 1 || visible || onHook)
+            {
+                fishSteps[i] = 1;
+            }
+            else
+            {
+                fishSteps[i] = stepPhase(i) % lodInterval == 0 ? lodInterval : 0;
+                lodSkippedFish += fishSteps[i] == 0;
+            }
+        }
+    }
+
+    // Like steersThisStep, but off-screen fish (see lodInterval) steer lodInterval times less often
+    bool steersNow(size_t fishIndex)
+    {
+        if (fishSteps[fishIndex] == 0)
+            return false;
+        if (fishSteps[fishIndex] == 1)
+            return steersThisStep(fishIndex);
+        return stepPhase(fishIndex) % (std::max(1, steeringInterval) * lodInterval) == 0;
+    }
+
+    // Constrain the joints of every fish in batches of up to BodyBatch::lanes fish with the same number of joints
+    void constrainAll()
+    {
+        // Group the fish by joint count so every lane of a batch runs the same number of joints
+        for (auto &group : fishByJointCount)
+        {
+            group.clear();
+        }
+        for (uint32_t i = 0; i < allFish.size(); i++)
+        {
+            size_t joints = allFish[i].jointCount;
+            if (joints >= fishByJointCount.size())
+            {
+                fishByJointCount.resize(joints + 1);
+            }
+            fishByJointCount[joints].push_back(i);
+        }
+
+        constrainBatches.clear();
+        for (uint32_t joints = 2; joints < fishByJointCount.size(); joints++)
+        {
+            for (uint32_t first = 0; first < fishByJointCount[joints].size(); first += BodyBatch::lanes)
+            {
+                constrainBatches.push_back({joints, first});
+            }
+        }
+
+        auto solveBatches = [&](size_t begin, size_t end, int thread)
+        {
+            BodyBatch &batch = threadBatches[thread];
+            for (size_t b = begin; b < end; b++)
             {
-                affectors.erase(affectors.begin() + i);
+                const std::vector<uint32_t> &group = fishByJointCount[constrainBatches[b].first];
+                uint32_t first = constrainBatches[b].second;
+                constrainBatch(batch, group.data() + first, std::min<int>(BodyBatch::lanes, group.size() - first));
             }
+        };
+
+        if (parallelStep && threadPool)
+        {
+            threadBatches.resize(threadPool->numThreads);
+            threadPool->parallelFor(constrainBatches.size(), solveBatches);
+        }
+        else
+        {
+            threadBatches.resize(1);
+            solveBatches(0, constrainBatches.size(), 0);
+        }
+    }
+
+    // Copy the fish at fishIndices into batch, constrain them together, and copy them back
+    void constrainBatch(BodyBatch &batch, const uint32_t *fishIndices, int count)
+    {
+        batch.resize(allFish[fishIndices[0]].jointCount);
+        batch.laneCount = count;
+        float *xs = batch.x.data();
+        float *ys = batch.y.data();
+        int jointCount = batch.jointCount;
+        for (int lane = 0; lane < BodyBatch::lanes; lane++)
+        {
+            const Fish &fish = allFish[fishIndices[lane < count ? lane : 0]];
+            glm::vec2 back = -glm::normalize(fish.forward);
+            batch.backX[lane] = back.x;
+            batch.backY[lane] = back.y;
+            batch.linkDistance[lane] = fish.linkDistance;
+            batch.cosMaxTurnAngle[lane] = fish.cosMaxTurnAngle;
+            batch.sinMaxTurnAngle[lane] = fish.sinMaxTurnAngle;
+
+            const glm::vec2 *points = fish.pointData();
+            for (int j = 0; j < jointCount; j++)
+            {
+                xs[j * BodyBatch::lanes + lane] = points[j].x;
+                ys[j * BodyBatch::lanes + lane] = points[j].y;
+            }
+        }
+
+        constrainKernel(batch);
+
+        for (int lane = 0; lane < count; lane++)
+        {
+            Fish &fish = allFish[fishIndices[lane]];
+            glm::vec2 *points = fish.pointData();
+            glm::vec2 *forwards = fish.forwardData();
+            forwards[0] = {batch.forwardX[lane], batch.forwardY[lane]};
+            for (int j = 1; j < jointCount; j++)
+            {
+                points[j] = {xs[j * BodyBatch::lanes + lane], ys[j * BodyBatch::lanes + lane]};
+                forwards[j] = {batch.forwardX[j * BodyBatch::lanes + lane], batch.forwardY[j * BodyBatch::lanes + lane]};
+            }
+            fish.forwardsValid = true;
         }
     }
 
     // Take one boids step
     void step(float dt)
     {
-        for (auto &fish : allFish)
+        if (reorderInterval > 0 && stepCount % reorderInterval == 0)
         {
-            // Calculate flocking behaviors
-            glm::vec2 separation = calculateSeparation(*fish) * separationWeight;
-            glm::vec2 alignment = calculateAlignment(*fish) * alignmentWeight;
-            glm::vec2 cohesion = calculateCohesion(*fish) * cohesionWeight;
-            glm::vec2 boundaryAvoidance = calculateBoundaryAvoidance(*fish) * 2.0f;
-            glm::vec2 attractorInfluence = calculateAttractorInfluence(*fish) * attractorWeight;
-            glm::vec2 repellorInfluence = calculateRepellorInfluence(*fish) * repellorWeight;
+            reorderByMortonCode();
+        }
 
-            // Combine all behaviors
-            glm::vec2 desiredDirection = separation + alignment + cohesion + boundaryAvoidance + attractorInfluence + repellorInfluence;
+        syncState();
+        if (topologicalNeighbors > 0)
+        {
+            kdTree.build(state.headX.data(), state.headY.data(), state.size());
+        }
+        else if (useNeighborLists)
+        {
+            if (neighborListsExpired())
+            {
+                buildNeighborLists();
+            }
+        }
+        else if (useSpatialGrid)
+        {
+            buildGrid();
+        }
+        if (useBarnesHut && topologicalNeighbors <= 0)
+        {
+            quadTree.build(state.headX.data(), state.headY.data(), state.forwardX.data(), state.forwardY.data(), state.size());
+        }
+        buildAffectorIndices();
+
+        assignLevelOfDetail();
+
+        if (parallelStep)
+        {
+            stepParallel(dt);
+            return;
+        }
 
-            if (glm::length(desiredDirection) > 0)
+        for (size_t i = 0; i < allFish.size(); i++)
+        {
+            int steps = fishSteps[i];
+            if (steps == 0)
+                continue;
+
+            Fish &fish = allFish[i];
+            if (steersNow(i))
             {
-                // Adjust fish direction based on the calculated behaviors
-                fish->forward = fish->forward * delta + desiredDirection * (1 - delta);
+                fish.desiredDirection = calculateDesiredDirection(i, candidates);
             }
+            fish.forward = steer(fish.forward, fish.desiredDirection, steps);
 
             // Update fish physics
-            fish->update(dt);
+            moveFish(fish, dt * steps);
+            state.set(i, fish);
         }
+        if (batchedConstrain)
+        {
+            constrainAll();
+        }
+        stepCount++;
     }
 
-    bool hookFish(glm::vec2 rodPosition, bool readyToHook)
+    // Take one boids step on the thread pool.
+    // First every fish steers using the headings and positions from the end of the last step, writing its new heading to a second buffer.
+    // Then every fish moves. Each fish only ever writes its own data, so the result is the same for any number of threads.
+    void stepParallel(float dt)
     {
-        // If a fish has already been hooked, update that fish
-        for (auto &fish : allFish)
+        if (!threadPool || threadPool->numThreads != numThreads)
         {
-            if (fish->hooked)
+            threadPool = std::make_unique<ThreadPool>(numThreads);
+            threadCandidates.resize(threadPool->numThreads);
+        }
+
+        nextForwardX.resize(allFish.size());
+        nextForwardY.resize(allFish.size());
+
+        // Steer
+        threadPool->parallelFor(allFish.size(), [&](size_t begin, size_t end, int thread)
+                                {
+            for (size_t i = begin; i < end; i++)
             {
-                fish->setHeadPosition(rodPosition);
-                return true;
-            }
+                if (steersNow(i))
+                {
+                    allFish[i].desiredDirection = calculateDesiredDirection(i, threadCandidates[thread]);
+                }
+                glm::vec2 forward = fishSteps[i] == 0 ? state.forward(i) : steer(state.forward(i), allFish[i].desiredDirection, fishSteps[i]);
+                nextForwardX[i] = forward.x;
+                nextForwardY[i] = forward.y;
+            } });
+
+        // Move
+        threadPool->parallelFor(allFish.size(), [&](size_t begin, size_t end, int /*thread*/)
+                                {
+            for (size_t i = begin; i < end; i++)
+            {
+                int steps = fishSteps[i];
+                if (steps == 0)
+                    continue;
+
+                Fish &fish = allFish[i];
+                fish.forward = {nextForwardX[i], nextForwardY[i]};
+                moveFish(fish, dt * steps);
+                state.set(i, fish);
+            } });
+        if (batchedConstrain)
+        {
+            constrainAll();
         }
+        stepCount++;
+    }
 
-        if (!readyToHook) {
+    bool hookFish(Rod &rod)
+    {
+        // If a fish has already been hooked, update that fish
+        Fish *hookedFish = getFish(rod.hookedFish);
+        if (hookedFish && hookedFish->hooked)
+        {
+            hookedFish->setHeadPosition(rod.pos);
+            return true;
+        }
+        rod.hookedFish = Handle(); // Got off the hook
+
+        if (!rod.readyToHook()) {
             return false;
         }
 
@@ -607,16 +1586,17 @@ struct Flock
         for (auto &fish : allFish)
         {
             // Get distance from rod
-            glm::vec2 diff = fish->getHeadPosition() - rodPosition;
+            glm::vec2 diff = fish.getHeadPosition() - rod.pos;
             float dist = glm::length(diff);
 
             // If close enough, hook fish
             if (dist < hookDist)
             {
-                fish->setHooked(true);
+                fish.setHooked(true);
+                rod.hookedFish = fish.handle;
 
                 // Update fish position
-                fish->setHeadPosition(rodPosition);
+                fish.setHeadPosition(rod.pos);
                 return true;
             }
         }
@@ -624,13 +1604,34 @@ struct Flock
         return false;
     }
 
-    // Render the flock
-    void render(sf::RenderWindow &window)
+    // Copy the fish into snapshot. With interpolateRender, each fish is placed between its last two steps, by how far the accumulated time is into the next step.
+    void takeSnapshot(FlockSnapshot &snapshot)
     {
-        for (auto &fish : allFish)
+        float alpha = interpolateRender ? std::clamp(accumulatedDt / fixedDt, 0.0f, 1.0f) : 1.0f;
+        snapshot.joints.points.resize(joints.size());
+        for (size_t j = 0; j < joints.size(); j++)
         {
-            fish->render(window);
+            snapshot.joints.points[j] = joints.previousPoints[j] + (joints.points[j] - joints.previousPoints[j]) * alpha;
         }
+
+        // The joints move so little in one step that the skeleton cache of the last step still fits the interpolated joints
+        snapshot.joints.sizes = joints.sizes;
+        snapshot.joints.forwards = joints.forwards;
+        snapshot.joints.angles = joints.angles;
+
+        snapshot.fish = allFish;
+        for (Fish &drawn : snapshot.fish)
+        {
+            drawn.joints = &snapshot.joints;
+            drawn.forward = drawn.previousForward + (drawn.forward - drawn.previousForward) * alpha;
+        }
+    }
+
+    // Render the flock from this thread
+    void render(sf::RenderWindow &window)
+    {
+        takeSnapshot(renderSnapshot);
+        renderSnapshot.render(window, fishTypes);
     }
 
     // Set the boundaries for the fish
@@ -638,38 +1639,61 @@ struct Flock
     {
         worldWidth = width;
         worldHeight = height;
+        bakePond();
+    }
+
+    void setPondShape(const PondShape &shape)
+    {
+        pond = shape;
+        bakePond();
+    }
+
+    // Bake the pond shape into pondField over the world bounds
+    void bakePond()
+    {
+        glm::vec2 worldSize = {worldWidth, worldHeight};
+        glm::vec2 areaMax = worldSize * 0.5f + glm::vec2(pondFieldMargin);
+        pondField.bake(-areaMax, areaMax, pondFieldCellSize, [&](glm::vec2 pos)
+                       { return pond.distance(pos, worldSize); });
     }
 
     void addAffector(Affector affector)
     {
-        affectors.push_back(affector);
+        if (affector.attractor)
+            attractors.add(affector);
+        else
+            repellors.add(affector);
     }
 
-    void pull()
+    // Start pulling in the fish on the rod's hook
+    void pull(Rod &rod)
     {
-        for (auto &fish : allFish)
+        Fish *fish = getFish(rod.hookedFish);
+        if (fish && fish->hooked)
         {
-            if (fish->hooked)
-            {
-                fish->setPulled(true);
-            }
+            fish->setPulled(true);
         }
     }
 
-    // Removes any fish that are being pulled from the flock. Returns the removed fish.
-    std::vector<Fish> finishPull()
+    // Removes the fish on the rod's hook from the flock if it is being pulled. Returns a record of each removed fish.
+    // The list is reused by the next call, so catching fish doesn't allocate.
+    const std::vector<CatchRecord> &finishPull(Rod &rod)
     {
-        std::vector<Fish> pulledFish;
-        for (int i = allFish.size() - 1; i >= 0; i--)
+        catches.clear();
+        int index = fishSlots.find(rod.hookedFish);
+        if (index >= 0 && allFish[index].pulled)
         {
-            auto &fish = allFish[i];
-            if (fish->pulled)
-            {
-                pulledFish.push_back(*fish);
-                allFish.erase(allFish.begin() + i);
-            }
+            const Fish &fish = allFish[index];
+            catches.push_back({fish.typeId, fish.linkDistance * (fish.jointCount - 1), fish.getHeadPosition()});
+            removeFish(index);
+        }
+
+        // Reclaim the removed fish's joints once they are most of the store
+        if (joints.holes() > joints.liveJoints)
+        {
+            compactJoints();
         }
-        return pulledFish;
+        return catches;
     }
 };
 
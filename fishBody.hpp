@@ -0,0 +1,203 @@
+#ifndef FISH_BODY_HPP
+#define FISH_BODY_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <array>
+
+// The joints of every fish in a flock, stored compressed sparse row style: one contiguous array per joint value,
+// with each fish owning the range offset to offset + count - 1 (see Fish::jointOffset and Fish::jointCount).
+// Fish with any number of joints share the same arrays, so a flock of long bodies is still a few large allocations.
+// Released ranges are pooled by length and handed out again by allocate, so a flock that catches and spawns fish at a steady rate stops allocating.
+struct JointStore
+{
+    std::vector<glm::vec2> points;
+    std::vector<float> sizes;
+    std::vector<glm::vec2> forwards; // Skeleton cache, see Fish::updateSkeleton
+    std::vector<float> angles;
+    std::vector<glm::vec2> previousPoints; // Joint positions before the last step, so rendering can interpolate between steps
+    size_t liveJoints = 0; // Number of joints owned by fish. The rest are holes.
+
+    std::vector<std::vector<uint32_t>> freeRanges; // freeRanges[n] holds the offsets of released ranges of n joints
+
+    // Scratch arrays the joints are copied into while compacting
+    std::vector<glm::vec2> compactPoints;
+    std::vector<float> compactSizes;
+    std::vector<glm::vec2> compactForwards;
+    std::vector<float> compactAngles;
+    std::vector<glm::vec2> compactPreviousPoints;
+
+    // Fish point at the store, so it must stay in place
+    JointStore() = default;
+    JointStore(const JointStore &) = delete;
+    JointStore &operator=(const JointStore &) = delete;
+
+    size_t size() const { return points.size(); }
+    size_t holes() const { return points.size() - liveJoints; }
+
+    // Get a range of count joints, reusing a released range of the same length if there is one. Returns the offset of the first joint.
+    uint32_t allocate(int count)
+    {
+        liveJoints += count;
+        if (count < (int)freeRanges.size() && !freeRanges[count].empty())
+        {
+            uint32_t offset = freeRanges[count].back();
+            freeRanges[count].pop_back();
+            return offset;
+        }
+        return grow(count);
+    }
+
+    // Add count joints to the end of the arrays, returning the offset of the first
+    uint32_t grow(int count)
+    {
+        uint32_t offset = points.size();
+        points.resize(offset + count, glm::vec2(0.0f));
+        sizes.resize(offset + count, 0.0f);
+        forwards.resize(offset + count, glm::vec2(0.0f));
+        angles.resize(offset + count, 0.0f);
+        previousPoints.resize(offset + count, glm::vec2(0.0f));
+        return offset;
+    }
+
+    // Add a joint after the count joints at offset, returning their new offset.
+    // The joints are moved to a new range first if another range is in the way.
+    uint32_t append(uint32_t offset, int count, glm::vec2 point, float size)
+    {
+        if (count > 0 && offset + count == points.size())
+        {
+            grow(1);
+            liveJoints++;
+        }
+        else
+        {
+            uint32_t newOffset = allocate(count + 1);
+            std::copy(points.begin() + offset, points.begin() + offset + count, points.begin() + newOffset);
+            std::copy(sizes.begin() + offset, sizes.begin() + offset + count, sizes.begin() + newOffset);
+            std::copy(forwards.begin() + offset, forwards.begin() + offset + count, forwards.begin() + newOffset);
+            std::copy(angles.begin() + offset, angles.begin() + offset + count, angles.begin() + newOffset);
+            std::copy(previousPoints.begin() + offset, previousPoints.begin() + offset + count, previousPoints.begin() + newOffset);
+            release(offset, count);
+            offset = newOffset;
+        }
+
+        points[offset + count] = point;
+        sizes[offset + count] = size;
+        previousPoints[offset + count] = point;
+        return offset;
+    }
+
+    // Give the count joints at offset back to the pool
+    void release(uint32_t offset, int count)
+    {
+        if (count == 0)
+            return;
+
+        liveJoints -= count;
+        if (count >= (int)freeRanges.size())
+        {
+            freeRanges.resize(count + 1);
+        }
+        freeRanges[count].push_back(offset);
+    }
+
+    // Compacting: call beginCompact, then keep for every live range (in the order they should end up in), then endCompact
+    void beginCompact()
+    {
+        compactPoints.clear();
+        compactSizes.clear();
+        compactForwards.clear();
+        compactAngles.clear();
+        compactPreviousPoints.clear();
+    }
+
+    // Copy the count joints at offset into the compacted arrays, returning their new offset
+    uint32_t keep(uint32_t offset, int count)
+    {
+        uint32_t newOffset = compactPoints.size();
+        compactPoints.insert(compactPoints.end(), points.begin() + offset, points.begin() + offset + count);
+        compactSizes.insert(compactSizes.end(), sizes.begin() + offset, sizes.begin() + offset + count);
+        compactForwards.insert(compactForwards.end(), forwards.begin() + offset, forwards.begin() + offset + count);
+        compactAngles.insert(compactAngles.end(), angles.begin() + offset, angles.begin() + offset + count);
+        compactPreviousPoints.insert(compactPreviousPoints.end(), previousPoints.begin() + offset, previousPoints.begin() + offset + count);
+        return newOffset;
+    }
+
+    void endCompact()
+    {
+        points.swap(compactPoints);
+        sizes.swap(compactSizes);
+        forwards.swap(compactForwards);
+        angles.swap(compactAngles);
+        previousPoints.swap(compactPreviousPoints);
+        liveJoints = points.size();
+        for (auto &ranges : freeRanges)
+        {
+            ranges.clear();
+        }
+    }
+};
+
+// Constrain one joint to linkDistance from the previous joint, bending at most the max turn angle away from back.
+// back is the direction the previous link points backwards, and is updated to this link's direction (minus the joint's forward direction).
+inline void constrainLink(const glm::vec2 &previous, glm::vec2 &point, glm::vec2 &back, float linkDistance, float cosMaxTurnAngle, float sinMaxTurnAngle)
+{
+    // Constrain distance
+    glm::vec2 diff = glm::normalize(point - previous);
+
+    // Constrain angle. If the joint bends too far, rotate back by exactly the max turn angle towards diff instead.
+    float cosAngle = glm::dot(back, diff);
+    if (cosAngle < cosMaxTurnAngle)
+    {
+        float sinAngle = back.x * diff.y - back.y * diff.x;
+        float sn = sinAngle >= 0.0f ? sinMaxTurnAngle : -sinMaxTurnAngle;
+        diff = {back.x * cosMaxTurnAngle - back.y * sn,
+                back.x * sn + back.y * cosMaxTurnAngle};
+    }
+    point = previous + diff * linkDistance;
+    back = diff;
+}
+
+// Constrain a body with a joint count known at compile time, so the loop is fully unrolled.
+// The unit forward direction of each joint after it was constrained is written to forwards.
+template <int NJoints>
+void constrainJoints(glm::vec2 *points, glm::vec2 *forwards, glm::vec2 back, float linkDistance, float cosMaxTurnAngle, float sinMaxTurnAngle)
+{
+    forwards[0] = -back;
+    for (int i = 1; i < NJoints; i++)
+    {
+        constrainLink(points[i - 1], points[i], back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+        forwards[i] = -back;
+    }
+}
+
+// Constrain a body with any number of joints. Short bodies use the unrolled version.
+inline void constrainJoints(glm::vec2 *points, glm::vec2 *forwards, int count, glm::vec2 back, float linkDistance, float cosMaxTurnAngle, float sinMaxTurnAngle)
+{
+    switch (count)
+    {
+    case 2:
+        return constrainJoints<2>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 3:
+        return constrainJoints<3>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 4:
+        return constrainJoints<4>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 5:
+        return constrainJoints<5>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 6:
+        return constrainJoints<6>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 7:
+        return constrainJoints<7>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    case 8:
+        return constrainJoints<8>(points, forwards, back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+    }
+    forwards[0] = -back;
+    for (int i = 1; i < count; i++)
+    {
+        constrainLink(points[i - 1], points[i], back, linkDistance, cosMaxTurnAngle, sinMaxTurnAngle);
+        forwards[i] = -back;
+    }
+}
+
+#endif
@@ -5,37 +5,46 @@
 
 struct FishEntry
 {
-    FishType type;
+    uint16_t typeId; // ID of the fish type in the flock's FishTypeRegistry
     int coinValue;
 
     int numCaught = 0;
     bool unlocked = false;
+    float largestCatch = 0.0f; // Size of the biggest fish of this type caught so far
 
-    FishEntry(FishType _type, int _coinValue)
-        : type(_type),
+    FishEntry(uint16_t _typeId = 0, int _coinValue = 0)
+        : typeId(_typeId),
           coinValue(_coinValue) {}
 };
 
 struct FishBook
 {
-    std::vector<FishEntry> entries;
+    std::vector<FishEntry> entries; // entries[typeId] is the entry for the fish type with that ID
 
-    int update(std::vector<Fish> &newFish)
+    // Add the entry for a fish type, replacing any entry it already had
+    void addEntry(const FishEntry &entry)
+    {
+        while (entries.size() <= entry.typeId)
+        {
+            entries.push_back(FishEntry(entries.size(), 0));
+        }
+        entries[entry.typeId] = entry;
+    }
+
+    int update(const std::vector<CatchRecord> &catches)
     {
         int newCoins = 0;
 
-        for (Fish &fish : newFish)
+        for (const CatchRecord &record : catches)
         {
-            for (FishEntry &entry : entries)
-            {
-                if (fish.name == entry.type.name)
-                {
-                    entry.numCaught++;
-                    entry.unlocked = true;
-                    newCoins += entry.coinValue;
-                    break;
-                }
-            }
+            if (record.typeId >= entries.size())
+                continue;
+
+            FishEntry &entry = entries[record.typeId];
+            entry.numCaught++;
+            entry.unlocked = true;
+            entry.largestCatch = std::max(entry.largestCatch, record.size);
+            newCoins += entry.coinValue;
         }
 
         return newCoins;
@@ -43,15 +52,8 @@ struct FishBook
 
     int getValue(const Fish &fish)
     {
-        for (const FishEntry &entry : entries)
-        {
-            if (fish.name == entry.type.name)
-            {
-                return entry.coinValue;
-            }
-        }
-        return 0;
+        return fish.typeId < entries.size() ? entries[fish.typeId].coinValue : 0;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,77 @@
+// Checks constrainJoints (fishBody.hpp), which clamps joint angles with a precomputed cos/sin, against the original atan2/rotate version of Fish::constrain.
+// Build like the game (see create.bat) with the repo root on the include path. Returns 1 if any joint is further than the tolerance from the original.
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "helperUtils.hpp"
+#include "fishBody.hpp"
+
+// Largest allowed distance between a joint and where the original constrain puts it, in world units.
+// The original goes through atan2, cos and sin for every joint, so the two agree to float rounding, not bitwise.
+const float tolerance = 1e-5f;
+
+// The original Fish::constrain, kept as the reference
+void constrainOriginal(std::vector<glm::vec2> &points, glm::vec2 forward, float linkDistance, float maxTurnAngle)
+{
+    auto jointForward = [&](int jointIndex)
+    {
+        if (jointIndex == 0)
+        {
+            return glm::normalize(forward);
+        }
+        return glm::normalize(points[jointIndex - 1] - points[jointIndex]);
+    };
+
+    for (size_t i = 1; i < points.size(); i++)
+    {
+        // Constrain distance
+        glm::vec2 diff = glm::normalize(points[i] - points[i - 1]);
+        points[i] = points[i - 1] + diff * linkDistance;
+
+        // Constrain angle
+        float angle = getAngle(jointForward(i - 1), jointForward(i));
+        angle = std::clamp(angle, -maxTurnAngle, maxTurnAngle);
+        diff = -jointForward(i - 1);
+        diff = rotate(diff, angle);
+        points[i] = points[i - 1] + diff * linkDistance;
+    }
+}
+
+int main()
+{
+    const int numBodies = 100000;
+    const int jointCount = 5;
+    uint32_t randSeed = 42;
+
+    float worst = 0.0f;
+    std::vector<glm::vec2> original(jointCount);
+    std::vector<glm::vec2> points(jointCount);
+    std::vector<glm::vec2> forwards(jointCount);
+    for (int body = 0; body < numBodies; body++)
+    {
+        // A randomly crumpled body with a random heading, link length and max turn angle
+        for (int j = 0; j < jointCount; j++)
+        {
+            original[j] = {randFloat(randSeed) * 2.0f - 1.0f, randFloat(randSeed) * 2.0f - 1.0f};
+        }
+        points = original;
+        float heading = randFloat(randSeed) * 2.0f * M_PI;
+        glm::vec2 forward = {std::cos(heading), std::sin(heading)};
+        float linkDistance = 0.05f + randFloat(randSeed) * 0.3f;
+        float maxTurnAngle = 10.0f + randFloat(randSeed) * 50.0f;
+
+        constrainOriginal(original, forward, linkDistance, maxTurnAngle);
+        constrainJoints(points.data(), forwards.data(), jointCount, -forward, linkDistance,
+                        std::cos(maxTurnAngle * deg2rad), std::sin(maxTurnAngle * deg2rad));
+
+        for (int j = 0; j < jointCount; j++)
+        {
+            worst = std::max(worst, glm::length(points[j] - original[j]));
+        }
+    }
+
+    bool ok = worst <= tolerance;
+    std::cout << numBodies << " bodies of " << jointCount << " joints: worst joint distance " << worst << " (tolerance " << tolerance << ") " << (ok ? "OK" : "FAILED") << "\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+// Times Flock::step with topological (k nearest) neighbors against the metric radii, for more and more fish in the same pond.
+// Build like the game (see create.bat) with the repo root on the include path. With the radii the cost per fish grows with the density, with k nearest it should stay about flat.
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+
+#include "fish.hpp"
+
+// Milliseconds per step for numFish fish in a fixed size pond, with topologicalNeighbors set to k (0 for the radii)
+double timeSteps(int numFish, int k)
+{
+    Flock flock(42, 1.0f / 60.0f);
+    flock.setWorldBounds(20.0f, 10.0f);
+    flock.fishTypes.add(FishType("Tiny Swift", 0.1f, 1.0f, 2.5f, sf::Color::Blue, sf::Color::Cyan, sf::Color::Cyan, sf::Color::Green));
+    flock.topologicalNeighbors = k;
+    for (int i = 0; i < numFish; i++)
+    {
+        flock.addRandomFish(0);
+    }
+
+    // Let the school form before timing, so the neighbor counts are the ones the game sees
+    const int warmupSteps = 50;
+    const int timedSteps = 100;
+    for (int i = 0; i < warmupSteps; i++)
+    {
+        flock.step(flock.fixedDt);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < timedSteps; i++)
+    {
+        flock.step(flock.fixedDt);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / timedSteps;
+}
+
+int main()
+{
+    const int k = 8;
+    const int fishCounts[] = {250, 500, 1000, 2000, 4000, 8000};
+
+    std::printf("%8s %14s %14s %18s %18s\n", "fish", "metric ms", "k-NN ms", "metric us/fish", "k-NN us/fish");
+    for (int numFish : fishCounts)
+    {
+        double metric = timeSteps(numFish, 0);
+        double nearest = timeSteps(numFish, k);
+        std::printf("%8d %14.3f %14.3f %18.3f %18.3f\n", numFish, metric, nearest, metric * 1000.0 / numFish, nearest * 1000.0 / numFish);
+    }
+    return 0;
+}
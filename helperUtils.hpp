@@ -64,6 +64,23 @@ float smoothstep(float t, float a, float b)
     return a * (1.0f - t) + b * t;
 }
 
+// Spread the 16 bits of value out to the even bits of the result
+uint32_t spreadBits(uint32_t value)
+{
+    value &= 0x0000FFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+// Returns the Z-order (Morton) code of the cell (x, y). Sorting by this code keeps cells that are close in 2D close in the sorted order.
+uint32_t mortonCode(uint16_t x, uint16_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
 // Draw a smooth line through the points.
 void drawSmoothLine(const std::vector<glm::vec2> &points, sf::RenderWindow &window,
                     bool loop = false, sf::Color color = sf::Color::White)
@@ -0,0 +1,73 @@
+#ifndef INFLUENCE_MAP_HPP
+#define INFLUENCE_MAP_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+// Coarse grid of nodes over an area, each holding the sum of the unit directions towards (or away from) every affector within reach of the node.
+// Affectors are added once, then any number of positions can be looked up with one bilinear sample each,
+// so the cost is the affectors' footprint on the grid instead of the number of lookups times the number of affectors.
+struct InfluenceMap
+{
+    float cellSize = 1.0f;           // Distance between neighboring nodes
+    glm::vec2 origin = {0.0f, 0.0f}; // World position of node (0, 0)
+    int width = 0;                   // Number of nodes along x
+    int height = 0;                  // Number of nodes along y
+    std::vector<glm::vec2> field;    // field[y * width + x] is the summed direction at node (x, y)
+
+    // Clear the map and fit it to the area from minPos to maxPos
+    void reset(glm::vec2 minPos, glm::vec2 maxPos, float _cellSize)
+    {
+        cellSize = _cellSize;
+        origin = minPos;
+        width = (int)std::ceil((maxPos.x - minPos.x) / cellSize) + 1;
+        height = (int)std::ceil((maxPos.y - minPos.y) / cellSize) + 1;
+        field.assign(width * height, glm::vec2(0.0f));
+    }
+
+    // Add the unit direction towards pos, times sign, to every node closer than radius to it
+    void add(glm::vec2 pos, float radius, float sign)
+    {
+        int minX = std::max(0, (int)std::ceil((pos.x - radius - origin.x) / cellSize));
+        int maxX = std::min(width - 1, (int)std::floor((pos.x + radius - origin.x) / cellSize));
+        int minY = std::max(0, (int)std::ceil((pos.y - radius - origin.y) / cellSize));
+        int maxY = std::min(height - 1, (int)std::floor((pos.y + radius - origin.y) / cellSize));
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            for (int x = minX; x <= maxX; x++)
+            {
+                glm::vec2 diff = pos - (origin + glm::vec2(x, y) * cellSize);
+                float distance = glm::length(diff);
+                if (distance < radius && distance > 0.0f)
+                {
+                    field[y * width + x] += diff * (sign / distance);
+                }
+            }
+        }
+    }
+
+    // Bilinearly interpolate the field at pos. Positions off the map get the value at its edge.
+    glm::vec2 sample(glm::vec2 pos) const
+    {
+        if (width == 0 || height == 0)
+            return glm::vec2(0.0f);
+
+        float fx = std::clamp((pos.x - origin.x) / cellSize, 0.0f, (float)(width - 1));
+        float fy = std::clamp((pos.y - origin.y) / cellSize, 0.0f, (float)(height - 1));
+        int x0 = std::min((int)fx, std::max(0, width - 2));
+        int y0 = std::min((int)fy, std::max(0, height - 2));
+        int x1 = std::min(x0 + 1, width - 1);
+        int y1 = std::min(y0 + 1, height - 1);
+        float tx = fx - x0;
+        float ty = fy - y0;
+
+        glm::vec2 bottom = field[y0 * width + x0] * (1.0f - tx) + field[y0 * width + x1] * tx;
+        glm::vec2 top = field[y1 * width + x0] * (1.0f - tx) + field[y1 * width + x1] * tx;
+        return bottom * (1.0f - ty) + top * ty;
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef KD_TREE_HPP
+#define KD_TREE_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <cfloat>
+
+// Balanced 2D KD-tree over the fish heads, used to find each fish's k nearest neighbors.
+// The tree is implicit: the node for the range order[lo] to order[hi - 1] is the point at order[(lo + hi) / 2],
+// with the points on the low side of its split axis before it and the rest after it.
+struct KdTree
+{
+    static constexpr int maxK = 32; // Largest number of neighbors findNearest can return
+
+    std::vector<uint32_t> order;   // Point indices in tree order
+    std::vector<uint8_t> axes;     // Split axis (0 = x, 1 = y) of the node at each position in order
+    std::vector<float> orderedX;   // Position of the point at each position in order, so queries read memory in order
+    std::vector<float> orderedY;
+
+    // Rebuild the tree from the points (xs[i], ys[i])
+    void build(const float *xs, const float *ys, size_t count)
+    {
+        order.resize(count);
+        axes.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            order[i] = i;
+        }
+        buildRange(xs, ys, 0, count);
+
+        orderedX.resize(count);
+        orderedY.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            orderedX[i] = xs[order[i]];
+            orderedY[i] = ys[order[i]];
+        }
+    }
+
+    // Split order[lo] to order[hi - 1] at its median along its widest axis, then split both halves
+    void buildRange(const float *xs, const float *ys, size_t lo, size_t hi)
+    {
+        if (hi - lo <= 1)
+        {
+            if (hi > lo)
+                axes[lo] = 0;
+            return;
+        }
+
+        float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+        for (size_t i = lo; i < hi; i++)
+        {
+            minX = std::min(minX, xs[order[i]]);
+            maxX = std::max(maxX, xs[order[i]]);
+            minY = std::min(minY, ys[order[i]]);
+            maxY = std::max(maxY, ys[order[i]]);
+        }
+        uint8_t axis = (maxY - minY) > (maxX - minX) ? 1 : 0;
+        const float *values = axis == 0 ? xs : ys;
+
+        size_t mid = (lo + hi) / 2;
+        std::nth_element(order.begin() + lo, order.begin() + mid, order.begin() + hi, [&](uint32_t a, uint32_t b)
+                         { return values[a] < values[b]; });
+        axes[mid] = axis;
+
+        buildRange(xs, ys, lo, mid);
+        buildRange(xs, ys, mid + 1, hi);
+    }
+
+    // Find the k nearest points to pos, not counting self, and write their indices to result (nearest first)
+    void findNearest(glm::vec2 pos, int k, uint32_t self, std::vector<uint32_t> &result) const
+    {
+        k = std::min(k, maxK);
+        float bestDistance2[maxK];
+        uint32_t bestIndex[maxK];
+        int found = 0;
+
+        searchRange(pos, k, self, 0, order.size(), bestDistance2, bestIndex, found);
+
+        result.assign(bestIndex, bestIndex + found);
+    }
+
+    // Search the subtree for order[lo] to order[hi - 1], keeping the k best points found so far sorted by distance
+    void searchRange(glm::vec2 pos, int k, uint32_t self, size_t lo, size_t hi, float *bestDistance2, uint32_t *bestIndex, int &found) const
+    {
+        if (hi <= lo)
+            return;
+
+        size_t mid = (lo + hi) / 2;
+        glm::vec2 point = {orderedX[mid], orderedY[mid]};
+        glm::vec2 diff = point - pos;
+
+        // Insert the node's point if it is one of the k nearest
+        float distance2 = glm::dot(diff, diff);
+        if (order[mid] != self && (found < k || distance2 < bestDistance2[found - 1]))
+        {
+            int slot = found < k ? found++ : k - 1;
+            while (slot > 0 && bestDistance2[slot - 1] > distance2)
+            {
+                bestDistance2[slot] = bestDistance2[slot - 1];
+                bestIndex[slot] = bestIndex[slot - 1];
+                slot--;
+            }
+            bestDistance2[slot] = distance2;
+            bestIndex[slot] = order[mid];
+        }
+
+        // Search the side pos is on first, then the other side if it could still hold a closer point
+        float split = axes[mid] == 0 ? diff.x : diff.y; // Positive if pos is on the low side
+        bool lowFirst = split > 0;
+        if (lowFirst)
+            searchRange(pos, k, self, lo, mid, bestDistance2, bestIndex, found);
+        else
+            searchRange(pos, k, self, mid + 1, hi, bestDistance2, bestIndex, found);
+
+        if (found < k || split * split < bestDistance2[found - 1])
+        {
+            if (lowFirst)
+                searchRange(pos, k, self, mid + 1, hi, bestDistance2, bestIndex, found);
+            else
+                searchRange(pos, k, self, lo, mid, bestDistance2, bestIndex, found);
+        }
+    }
+};
+
+#endif
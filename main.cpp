@@ -1,15 +1,19 @@
-#include "fishBook.hpp"
-#include "ripple.hpp"
+#include "allocationCounter.hpp"
+#include "simThread.hpp"
 
 int main()
 {
     // Settings
     // #################################
     int fixedUpdateRate = 500;
+    int steeringRate = 50; // How many times per second each fish recalculates where it wants to go
     int maxFrameRate = 60;
+    int simTickRate = 120; // How many times per second the sim thread steps and publishes a snapshot to draw
     const float CAMERA_HEIGHT = 10.0f;
     int numFish = 20;
     uint32_t randSeed = 42;
+    bool multithreadedSim = false; // Split the flock simulation across all CPU cores
+    bool respawnCaughtFish = true; // Replace every caught fish with a new random one, so the pond never empties
     // #################################
 
     // Init window
@@ -38,35 +42,56 @@ int main()
     // Create flock and add fish
     Flock flock = Flock(randSeed, 1.0f / (float)fixedUpdateRate);
     flock.setWorldBounds(CAMERA_HEIGHT * aspectRatio, CAMERA_HEIGHT);
-
-    // Predefined fish types
-    std::vector<FishType> fishTypes = {
-        FishType("Tiny Swift", 0.1f, 1.0f, 2.5f, sf::Color::Blue, sf::Color::Cyan, sf::Color::Cyan, sf::Color::Green),
-        FishType("Medium Cruiser", 0.2f, 1.0f, 1.5f, {255, 127, 0}, sf::Color::Red, sf::Color::Red, sf::Color::Black),
-        FishType("Large Slowpoke", 0.3f, 1.2f, 0.7f, sf::Color::Green, {0, 200, 0}, {0, 200, 0}, sf::Color::Red)};
+    flock.setView({cameraView.getCenter().x, cameraView.getCenter().y}, {cameraView.getSize().x, cameraView.getSize().y});
+    flock.parallelStep = multithreadedSim;
+    flock.steeringInterval = std::max(1, fixedUpdateRate / steeringRate);
+
+    // Pond shape, as fractions of the world size (see PondShape): a wobbly shoreline, a dock on the left where the rod is, and a few rocks
+    PondShape pond;
+    const int shorePoints = 32;
+    for (int i = 0; i < shorePoints; i++)
+    {
+        float angle = i * 2.0f * M_PI / shorePoints;
+        float wobble = 1.0f + 0.05f * std::sin(3.0f * angle) + 0.03f * std::cos(5.0f * angle + 1.0f);
+        pond.shore.push_back({0.46f * wobble * std::cos(angle), 0.44f * wobble * std::sin(angle)});
+    }
+    pond.docks.push_back({{-0.44f, 0.0f}, {0.07f, 0.03f}});
+    pond.rocks.push_back({{0.2f, 0.22f}, 0.05f});
+    pond.rocks.push_back({{0.27f, 0.15f}, 0.03f});
+    pond.rocks.push_back({{-0.12f, -0.28f}, 0.06f});
+    flock.setPondShape(pond);
+
+    // Predefined fish types. Their IDs are the order they are added in.
+    flock.fishTypes.add(FishType("Tiny Swift", 0.1f, 1.0f, 2.5f, sf::Color::Blue, sf::Color::Cyan, sf::Color::Cyan, sf::Color::Green));
+    flock.fishTypes.add(FishType("Medium Cruiser", 0.2f, 1.0f, 1.5f, {255, 127, 0}, sf::Color::Red, sf::Color::Red, sf::Color::Black));
+    flock.fishTypes.add(FishType("Large Slowpoke", 0.3f, 1.2f, 0.7f, sf::Color::Green, {0, 200, 0}, {0, 200, 0}, sf::Color::Red));
+    flock.fishTypes.add(FishType("Eel", 0.1f, 0.6f, 1.2f, {90, 70, 40}, {60, 45, 25}, {60, 45, 25}, sf::Color::Yellow, 24, {1.0f, 1.1f, 1.0f, 0.8f, 0.3f}));
 
     // Add fish at random positions
     for (int i = 0; i < numFish; ++i)
     {
-        flock.addRandomFish(fishTypes[randInt(randSeed, 3)]);
+        flock.addRandomFish(randInt(randSeed, flock.fishTypes.size()));
     }
 
     // Init rod
     Rod rod = Rod({-0.5f * CAMERA_HEIGHT * aspectRatio, 0.0f}, 0.05f, 3.0f, 3.0f);
 
     // Init inventory
-    int coins = 0;
     FishBook book;
-    book.entries.push_back(FishEntry(fishTypes[0], 1));
-    book.entries.push_back(FishEntry(fishTypes[1], 3));
-    book.entries.push_back(FishEntry(fishTypes[2], 5));
+    book.addEntry(FishEntry(0, 1));
+    book.addEntry(FishEntry(1, 3));
+    book.addEntry(FishEntry(2, 5));
+    book.addEntry(FishEntry(3, 4));
 
-    // Init ripples
-    std::vector<Ripple> ripples;
+    // Start simulating. From here on the flock, rod and book belong to the sim thread, and this thread only draws its snapshots (reading just the fish types and pond shape, which no longer change).
+    SimThread sim(flock, rod, book, randSeed, respawnCaughtFish, simTickRate);
+    sim.start();
 
     // Init game clock
     sf::Clock gameClock;
 
+    uint64_t skeletonMathCallsLastFrame = 0; // atan2/normalize calls made while drawing the last frame
+
     while (window.isOpen())
     {
         const float dt = gameClock.restart().asSeconds();
@@ -90,54 +115,35 @@ int main()
                 cameraView.setSize(CAMERA_HEIGHT * newAspectRatio, CAMERA_HEIGHT);
 
                 // Update world bounds
-                flock.setWorldBounds(CAMERA_HEIGHT * newAspectRatio, CAMERA_HEIGHT);
+                InputEvent resize;
+                resize.type = InputEvent::Resize;
+                resize.pos = {cameraView.getCenter().x, cameraView.getCenter().y};
+                resize.size = {cameraView.getSize().x, cameraView.getSize().y};
+                sim.send(resize);
             }
             else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
             {
                 sf::Vector2i pixelCoords = {event.mouseButton.x, event.mouseButton.y};
                 sf::Vector2f coords = window.mapPixelToCoords(pixelCoords, cameraView);
-                ripples.push_back(Ripple(32, coords, 3.0f, 1.0f, randSeed));
-                rod.setCastPos({coords.x, coords.y});
-                flock.addAffector(Affector(false, rod.castPos, 1.0f));
+                InputEvent cast;
+                cast.type = InputEvent::Cast;
+                cast.pos = {coords.x, coords.y};
+                sim.send(cast);
             }
             else if (event.type == sf::Event::KeyPressed)
             {
                 if (event.key.code == sf::Keyboard::Space)
                 {
-                    flock.pull();
-                    rod.startPulling();
+                    InputEvent pull;
+                    pull.type = InputEvent::Pull;
+                    sim.send(pull);
                 }
             }
         }
 
-        // Update ripples
-        for (int i = ripples.size() - 1; i >= 0; i--)
-        {
-            ripples[i].update(dt);
-            if (ripples[i].done())
-            {
-                ripples.erase(ripples.begin() + i);
-            }
-        }
-
-        // Handle rod pulling
-        rod.update(dt);
-
-        if (rod.finishedPulling())
-        {
-            // Get pulled fish
-            std::vector<Fish> pulledFish = flock.finishPull();
-
-            // Update fish book
-            int newCoins = book.update(pulledFish);
-            coins += newCoins;
-
-            // Reset rod
-            rod.reset();
-        }
-
-        // Update flock
-        flock.update(dt, rod);
+        // Get the latest snapshot from the sim thread. If there isn't a new one, the last one is drawn again.
+        sim.snapshots.update();
+        SimSnapshot &snapshot = sim.snapshots.readBuffer();
 
         // Update info text
         std::ostringstream ss;
@@ -146,25 +152,34 @@ int main()
         ss << "FPS: " << 1.0f / dt << "\n";
         ss << "Camera Height: " << CAMERA_HEIGHT << "\n";
         ss << "Camera Width: " << CAMERA_HEIGHT * aspectRatio << "\n";
-        ss << "# Fish: " << flock.allFish.size() << "\n";
-        ss << "Coins: " << coins << "\n";
+        ss << "# Fish: " << snapshot.numFish << "\n";
+        ss << "Sim Tick Time: " << snapshot.tickTime * 1000.0f << "ms\n";
+        ss << "Neighbor List Rebuilds: " << snapshot.neighborListRebuilds << "\n";
+        ss << "Off-screen Fish Skipped: " << snapshot.lodSkippedFish << "\n";
+        ss << "Skeleton atan2/normalize Calls: " << skeletonMathCallsLastFrame << "\n";
+        ss << "Sim Heap Allocations: " << snapshot.simHeapAllocations << "\n";
+        ss << "Dropped Sim Time: " << snapshot.droppedSimTime << "s\n";
+        ss << "Coins: " << snapshot.coins << "\n";
         infoText.setString(ss.str());
 
         // Clear screen
         window.clear(sf::Color::Black);
 
-        // Draw fish with camera view
+        // Draw pond and fish with camera view
         window.setView(cameraView);
-        flock.render(window);
+        flock.pond.render(window, snapshot.worldSize);
+        uint64_t skeletonMathCallsBefore = Fish::skeletonMathCalls;
+        snapshot.flock.render(window, flock.fishTypes);
+        skeletonMathCallsLastFrame = Fish::skeletonMathCalls - skeletonMathCallsBefore;
 
         // Draw ripples
-        for (Ripple &ripple : ripples)
+        for (RippleArc &arc : snapshot.rippleArcs)
         {
-            ripple.render(window);
+            arc.render(window);
         }
 
         // Draw rod
-        rod.render(window);
+        snapshot.rod.render(window);
 
         // Draw UI with default view
         window.setView(view);
@@ -0,0 +1,120 @@
+#ifndef POND_SHAPE_HPP
+#define POND_SHAPE_HPP
+
+#include <SFML/Graphics.hpp>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <cfloat>
+#include <cmath>
+
+// A round obstacle in the pond
+struct PondRock
+{
+    glm::vec2 center;
+    float radius;
+};
+
+// A rectangular obstacle in the pond, such as a dock
+struct PondDock
+{
+    glm::vec2 center;
+    glm::vec2 halfSize;
+};
+
+// The shape of the water: a shoreline with rocks and docks in it.
+// Positions and sizes are fractions of the world size (x and y from -0.5 to 0.5 span the world, and radii are fractions of its height),
+// so the pond stretches with the window the same way the world bounds do.
+struct PondShape
+{
+    std::vector<glm::vec2> shore; // Closed polygon around the water. If empty, the world bounds are the shore.
+    std::vector<PondRock> rocks;
+    std::vector<PondDock> docks;
+
+    // Exact signed distance from pos (in world units) to the nearest land, positive in the water and negative on land.
+    // Checks every shore edge and obstacle, so it is only meant for baking a SignedDistanceField.
+    float distance(glm::vec2 pos, glm::vec2 worldSize) const
+    {
+        float water = shore.empty() ? -boxDistance(pos, glm::vec2(0.0f), worldSize * 0.5f) : shoreDistance(pos, worldSize);
+
+        for (const PondRock &rock : rocks)
+        {
+            water = std::min(water, glm::length(pos - rock.center * worldSize) - rock.radius * worldSize.y);
+        }
+        for (const PondDock &dock : docks)
+        {
+            water = std::min(water, boxDistance(pos, dock.center * worldSize, dock.halfSize * worldSize));
+        }
+        return water;
+    }
+
+    // Signed distance to the shore polygon, positive inside it
+    float shoreDistance(glm::vec2 pos, glm::vec2 worldSize) const
+    {
+        float minDistance2 = FLT_MAX;
+        bool inside = false;
+        for (size_t i = 0, j = shore.size() - 1; i < shore.size(); j = i++)
+        {
+            glm::vec2 a = shore[j] * worldSize;
+            glm::vec2 b = shore[i] * worldSize;
+
+            // Distance to the edge
+            glm::vec2 edge = b - a;
+            float t = std::clamp(glm::dot(pos - a, edge) / glm::dot(edge, edge), 0.0f, 1.0f);
+            glm::vec2 diff = pos - (a + edge * t);
+            minDistance2 = std::min(minDistance2, glm::dot(diff, diff));
+
+            // Count the edges a ray going right from pos crosses
+            if ((a.y > pos.y) != (b.y > pos.y) && pos.x < a.x + (pos.y - a.y) / (b.y - a.y) * edge.x)
+                inside = !inside;
+        }
+        float distance = std::sqrt(minDistance2);
+        return inside ? distance : -distance;
+    }
+
+    // Signed distance to an axis aligned box, positive outside it
+    static float boxDistance(glm::vec2 pos, glm::vec2 center, glm::vec2 halfSize)
+    {
+        glm::vec2 q = glm::abs(pos - center) - halfSize;
+        return glm::length(glm::max(q, glm::vec2(0.0f))) + std::min(std::max(q.x, q.y), 0.0f);
+    }
+
+    void render(sf::RenderWindow &window, glm::vec2 worldSize) const
+    {
+        // Shoreline
+        if (!shore.empty())
+        {
+            sf::VertexArray shoreLine(sf::LineStrip, shore.size() + 1);
+            for (size_t i = 0; i <= shore.size(); i++)
+            {
+                glm::vec2 point = shore[i % shore.size()] * worldSize;
+                shoreLine[i] = sf::Vertex({point.x, point.y}, {194, 178, 128});
+            }
+            window.draw(shoreLine);
+        }
+
+        // Rocks
+        for (const PondRock &rock : rocks)
+        {
+            float radius = rock.radius * worldSize.y;
+            sf::CircleShape circle(radius);
+            circle.setFillColor({110, 110, 110});
+            circle.setOrigin(radius, radius);
+            circle.setPosition(rock.center.x * worldSize.x, rock.center.y * worldSize.y);
+            window.draw(circle);
+        }
+
+        // Docks
+        for (const PondDock &dock : docks)
+        {
+            glm::vec2 halfSize = dock.halfSize * worldSize;
+            sf::RectangleShape rectangle({halfSize.x * 2.0f, halfSize.y * 2.0f});
+            rectangle.setFillColor({120, 85, 50});
+            rectangle.setOrigin(halfSize.x, halfSize.y);
+            rectangle.setPosition(dock.center.x * worldSize.x, dock.center.y * worldSize.y);
+            window.draw(rectangle);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef QUAD_TREE_HPP
+#define QUAD_TREE_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <cmath>
+
+#include "boidsSimd.hpp"
+
+// A node of the quad tree. Every node stores the totals of the points below it, so a far away node can stand in for all of them.
+struct QuadNode
+{
+    glm::vec2 center = {0.0f, 0.0f};
+    float halfSize = 0.0f;
+
+    glm::vec2 positionSum = {0.0f, 0.0f}; // Sum of the positions of the points below this node
+    glm::vec2 headingSum = {0.0f, 0.0f};  // Sum of the headings of the points below this node
+    int count = 0;
+
+    int firstChild = -1; // The 4 children are stored at nodes[firstChild] to nodes[firstChild + 3]. -1 for a leaf.
+    uint32_t start = 0;  // The points below this node are order[start] to order[end - 1]
+    uint32_t end = 0;
+};
+
+// Barnes-Hut quad tree over the fish heads, used to approximate cohesion and alignment over large radii.
+// A group of fish that is small compared to its distance is treated as a single neighbor at its center of mass.
+struct QuadTree
+{
+    int leafSize = 8;  // Nodes with this many points or fewer are not split
+    int maxDepth = 16; // Stops splitting when many points are at the same position. At most 32, see accumulate.
+
+    std::vector<QuadNode> nodes;
+    std::vector<uint32_t> order; // Point indices, sorted so each node's points are contiguous
+
+    // The arrays the tree was built from, read again when visiting leaves
+    const float *xs = nullptr;
+    const float *ys = nullptr;
+    const float *headingXs = nullptr;
+    const float *headingYs = nullptr;
+
+    // Rebuild the tree from the points (_xs[i], _ys[i]) with headings (_headingXs[i], _headingYs[i]). The arrays must stay valid until the next build.
+    void build(const float *_xs, const float *_ys, const float *_headingXs, const float *_headingYs, size_t count)
+    {
+        xs = _xs;
+        ys = _ys;
+        headingXs = _headingXs;
+        headingYs = _headingYs;
+
+        nodes.clear();
+        order.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            order[i] = i;
+        }
+        if (count == 0)
+            return;
+
+        // Fit a square root node around the points
+        glm::vec2 minPos = {xs[0], ys[0]};
+        glm::vec2 maxPos = {xs[0], ys[0]};
+        for (size_t i = 1; i < count; i++)
+        {
+            minPos = {std::min(minPos.x, xs[i]), std::min(minPos.y, ys[i])};
+            maxPos = {std::max(maxPos.x, xs[i]), std::max(maxPos.y, ys[i])};
+        }
+        float halfSize = 0.5f * std::max(maxPos.x - minPos.x, maxPos.y - minPos.y) + 1e-3f;
+
+        nodes.resize(1);
+        buildNode(0, 0, count, (minPos + maxPos) * 0.5f, halfSize, 0);
+    }
+
+    // Fill in nodes[nodeIndex] for the points order[start] to order[end - 1], splitting it if it has too many points
+    void buildNode(int nodeIndex, uint32_t start, uint32_t end, glm::vec2 center, float halfSize, int depth)
+    {
+        QuadNode node;
+        node.center = center;
+        node.halfSize = halfSize;
+        node.start = start;
+        node.end = end;
+        node.count = end - start;
+        for (uint32_t i = start; i < end; i++)
+        {
+            uint32_t point = order[i];
+            node.positionSum += glm::vec2(xs[point], ys[point]);
+            node.headingSum += glm::vec2(headingXs[point], headingYs[point]);
+        }
+
+        if (node.count <= leafSize || depth >= std::min(maxDepth, 32))
+        {
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        // Split the points into quadrants: (-x, -y), (-x, +y), (+x, -y), (+x, +y)
+        uint32_t *first = order.data() + start;
+        uint32_t *last = order.data() + end;
+        uint32_t *midX = std::partition(first, last, [&](uint32_t i)
+                                        { return xs[i] < center.x; });
+        uint32_t *midLow = std::partition(first, midX, [&](uint32_t i)
+                                          { return ys[i] < center.y; });
+        uint32_t *midHigh = std::partition(midX, last, [&](uint32_t i)
+                                           { return ys[i] < center.y; });
+        uint32_t bounds[5] = {start,
+                              (uint32_t)(midLow - order.data()),
+                              (uint32_t)(midX - order.data()),
+                              (uint32_t)(midHigh - order.data()),
+                              end};
+
+        node.firstChild = nodes.size();
+        nodes[nodeIndex] = node;
+        nodes.resize(nodes.size() + 4);
+
+        float childHalfSize = halfSize * 0.5f;
+        for (int q = 0; q < 4; q++)
+        {
+            glm::vec2 offset = {q < 2 ? -childHalfSize : childHalfSize, q % 2 == 0 ? -childHalfSize : childHalfSize};
+            buildNode(node.firstChild + q, bounds[q], bounds[q + 1], center + offset, childHalfSize, depth + 1);
+        }
+    }
+
+    // Add the alignment and cohesion totals of every point within the radii of pos (except self) to sums.
+    // Nodes entirely inside a radius are added from their totals, which is exact. Nodes crossing the edge of a radius are only opened
+    // if their size divided by the distance to their center of mass is above theta. Otherwise they count as one neighbor at their center of mass.
+    void accumulate(glm::vec2 pos, uint32_t self, float alignmentRadius, float cohesionRadius, float theta, NeighborSums &sums) const
+    {
+        if (nodes.empty())
+            return;
+
+        float alignmentRadius2 = alignmentRadius * alignmentRadius;
+        float cohesionRadius2 = cohesionRadius * cohesionRadius;
+
+        // Every visited node adds at most 4 children, so the stack never needs more than 3 slots per level
+        int stack[3 * 32 + 4];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const QuadNode &node = nodes[stack[--stackSize]];
+            if (node.count == 0)
+                continue;
+
+            // Closest and furthest distance from pos to the node's square
+            glm::vec2 fromCenter = {std::abs(pos.x - node.center.x), std::abs(pos.y - node.center.y)};
+            glm::vec2 nearest = {std::max(fromCenter.x - node.halfSize, 0.0f), std::max(fromCenter.y - node.halfSize, 0.0f)};
+            glm::vec2 furthest = fromCenter + glm::vec2(node.halfSize);
+            float nearest2 = glm::dot(nearest, nearest);
+            float furthest2 = glm::dot(furthest, furthest);
+
+            bool alignmentInside = furthest2 < alignmentRadius2;
+            bool cohesionInside = furthest2 < cohesionRadius2;
+            bool alignmentCrosses = !alignmentInside && nearest2 < alignmentRadius2;
+            bool cohesionCrosses = !cohesionInside && nearest2 < cohesionRadius2;
+            if (!alignmentInside && !cohesionInside && !alignmentCrosses && !cohesionCrosses)
+                continue;
+
+            // A node containing pos also contains self, so it is always opened and self is skipped in its leaf
+            bool containsPos = nearest.x == 0.0f && nearest.y == 0.0f;
+            if (!containsPos)
+            {
+                bool useNode = !alignmentCrosses && !cohesionCrosses;
+                if (!useNode)
+                {
+                    glm::vec2 diff = pos - node.positionSum / (float)node.count;
+                    float size = 2.0f * node.halfSize;
+                    useNode = size * size < theta * theta * glm::dot(diff, diff);
+                    if (useNode)
+                    {
+                        // Far enough away to use the center of mass to decide which side of the edge the node is on
+                        alignmentInside = alignmentInside || (alignmentCrosses && glm::dot(diff, diff) < alignmentRadius2);
+                        cohesionInside = cohesionInside || (cohesionCrosses && glm::dot(diff, diff) < cohesionRadius2);
+                    }
+                }
+
+                if (useNode)
+                {
+                    if (alignmentInside)
+                    {
+                        sums.alignment += node.headingSum;
+                        sums.alignmentCount += node.count;
+                    }
+                    if (cohesionInside)
+                    {
+                        sums.cohesion += node.positionSum;
+                        sums.cohesionCount += node.count;
+                    }
+                    continue;
+                }
+            }
+
+            // Visit every point in a leaf
+            if (node.firstChild < 0)
+            {
+                for (uint32_t i = node.start; i < node.end; i++)
+                {
+                    uint32_t other = order[i];
+                    if (other == self)
+                        continue;
+
+                    glm::vec2 otherPos = {xs[other], ys[other]};
+                    glm::vec2 diff = pos - otherPos;
+                    float distance2 = glm::dot(diff, diff);
+                    if (distance2 < alignmentRadius2)
+                    {
+                        sums.alignment += glm::vec2(headingXs[other], headingYs[other]);
+                        sums.alignmentCount++;
+                    }
+                    if (distance2 < cohesionRadius2)
+                    {
+                        sums.cohesion += otherPos;
+                        sums.cohesionCount++;
+                    }
+                }
+                continue;
+            }
+
+            for (int q = 0; q < 4; q++)
+            {
+                stack[stackSize++] = node.firstChild + q;
+            }
+        }
+    }
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include <SFML/Graphics.hpp>
 #include <glm/glm.hpp>
 
+#include "slotMap.hpp"
+
 struct Rod
 {
     glm::vec2 origin;
@@ -20,6 +22,8 @@ struct Rod
     float timeSinceHooked = 0.0f;
     float timeBetweenHooks;
 
+    Handle hookedFish; // The fish on the hook, see Flock::getFish
+
     Rod(glm::vec2 _origin, float _radius, float _pullTimeMax, float _timeBetweenHooks)
         : origin(_origin),
           pos(_origin),
@@ -66,6 +70,7 @@ struct Rod
         pulling = false;
         pullTimer = 0.0f;
         cast = false;
+        hookedFish = Handle();
     }
 
     void render(sf::RenderWindow &window)
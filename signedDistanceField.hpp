@@ -0,0 +1,103 @@
+#ifndef SIGNED_DISTANCE_FIELD_HPP
+#define SIGNED_DISTANCE_FIELD_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+
+// Grid of nodes over an area, each holding the signed distance from the node to a shape, baked once from an exact (but slow) distance function.
+// Afterwards the distance and its gradient anywhere in the area are bilinearly interpolated from the four nearest nodes, so each lookup is O(1).
+struct SignedDistanceField
+{
+    static constexpr size_t maxNodes = 1 << 18; // Nodes are spread further apart if the area would need more than this
+
+    float cellSize = 1.0f;           // Distance between neighboring nodes
+    glm::vec2 origin = {0.0f, 0.0f}; // World position of node (0, 0)
+    int width = 0;                   // Number of nodes along x
+    int height = 0;                  // Number of nodes along y
+    std::vector<float> distances;    // distances[y * width + x] is the distance at node (x, y)
+
+    // Fill the field over the area from minPos to maxPos with nodes _cellSize apart, calling distance(pos) once per node
+    template <typename DistanceFunc>
+    void bake(glm::vec2 minPos, glm::vec2 maxPos, float _cellSize, DistanceFunc distance)
+    {
+        cellSize = _cellSize;
+        while (true)
+        {
+            width = (int)std::ceil((maxPos.x - minPos.x) / cellSize) + 1;
+            height = (int)std::ceil((maxPos.y - minPos.y) / cellSize) + 1;
+            if ((size_t)width * (size_t)height <= maxNodes)
+                break;
+            cellSize *= 2.0f;
+        }
+        origin = minPos;
+
+        distances.resize(width * height);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                distances[y * width + x] = distance(origin + glm::vec2(x, y) * cellSize);
+            }
+        }
+    }
+
+    // Find the cell pos is in, clamped to the field, and how far across it pos is along each axis (0 to 1)
+    void locate(glm::vec2 pos, int &x0, int &y0, float &tx, float &ty) const
+    {
+        float fx = std::clamp((pos.x - origin.x) / cellSize, 0.0f, (float)(width - 1));
+        float fy = std::clamp((pos.y - origin.y) / cellSize, 0.0f, (float)(height - 1));
+        x0 = std::min((int)fx, std::max(0, width - 2));
+        y0 = std::min((int)fy, std::max(0, height - 2));
+        tx = fx - x0;
+        ty = fy - y0;
+    }
+
+    // Get the distance at pos. Positions off the field get the distance at its edge.
+    float sample(glm::vec2 pos) const
+    {
+        if (width == 0 || height == 0)
+            return FLT_MAX;
+
+        int x0, y0;
+        float tx, ty;
+        locate(pos, x0, y0, tx, ty);
+        int x1 = std::min(x0 + 1, width - 1);
+        int y1 = std::min(y0 + 1, height - 1);
+
+        float bottom = distances[y0 * width + x0] * (1.0f - tx) + distances[y0 * width + x1] * tx;
+        float top = distances[y1 * width + x0] * (1.0f - tx) + distances[y1 * width + x1] * tx;
+        return bottom * (1.0f - ty) + top * ty;
+    }
+
+    // Get the unit direction the distance increases fastest in at pos, or zero if the field is flat there
+    glm::vec2 gradient(glm::vec2 pos) const
+    {
+        if (width == 0 || height == 0)
+            return glm::vec2(0.0f);
+
+        int x0, y0;
+        float tx, ty;
+        locate(pos, x0, y0, tx, ty);
+        int x1 = std::min(x0 + 1, width - 1);
+        int y1 = std::min(y0 + 1, height - 1);
+
+        float d00 = distances[y0 * width + x0];
+        float d10 = distances[y0 * width + x1];
+        float d01 = distances[y1 * width + x0];
+        float d11 = distances[y1 * width + x1];
+        glm::vec2 slope = {(d10 - d00) * (1.0f - ty) + (d11 - d01) * ty,
+                           (d01 - d00) * (1.0f - tx) + (d11 - d10) * tx};
+
+        if (glm::length(slope) > 0)
+        {
+            return glm::normalize(slope);
+        }
+
+        return glm::vec2(0.0f);
+    }
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+
+#include <chrono>
+#include <thread>
+
+#include "fishBook.hpp"
+#include "ripple.hpp"
+#include "tripleBuffer.hpp"
+#include "spscQueue.hpp"
+
+extern thread_local uint64_t heapAllocations; // See allocationCounter.hpp
+
+// Something the player did, sent from the render thread to the sim thread
+struct InputEvent
+{
+    enum Type
+    {
+        Cast,  // Cast the rod to pos
+        Pull,  // Start pulling the rod in
+        Resize // The camera view is now size world units, centered on pos
+    };
+
+    Type type = Cast;
+    glm::vec2 pos = {0.0f, 0.0f};
+    glm::vec2 size = {0.0f, 0.0f};
+};
+
+// Everything the render thread needs to draw a frame and the info text, published by the sim thread after every tick
+struct SimSnapshot
+{
+    FlockSnapshot flock;
+    Rod rod = Rod({0.0f, 0.0f}, 0.0f, 0.0f, 0.0f);
+    std::vector<RippleArc> rippleArcs; // The arcs of every ripple, flattened so copying them doesn't allocate once the vector is big enough
+    glm::vec2 worldSize = {0.0f, 0.0f};  // For drawing the pond, which is sized relative to the world
+
+    // Stats
+    size_t numFish = 0;
+    int neighborListRebuilds = 0;
+    size_t lodSkippedFish = 0;
+    uint64_t simHeapAllocations = 0; // Heap allocations made while stepping in the tick that published this snapshot
+    float droppedSimTime = 0.0f;
+    float tickTime = 0.0f; // Seconds the tick spent stepping
+    int coins = 0;
+};
+
+// Steps the flock, rod and ripples on a thread of their own, so a slow step doesn't hold up drawing.
+// The render thread sends input with send and draws the latest snapshot from snapshots. Neither ever waits on the sim thread.
+// Once started, the flock, rod and book passed in belong to the sim thread until stop.
+struct SimThread
+{
+    Flock &flock;
+    Rod &rod;
+    FishBook &book;
+    std::vector<Ripple> ripples;
+    uint32_t randSeed;
+    bool respawnCaughtFish;
+    int coins = 0;
+
+    std::chrono::duration<double> tickPeriod; // Time between the starts of two ticks
+
+    SpscQueue<InputEvent, 64> input;
+    TripleBuffer<SimSnapshot> snapshots;
+
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    SimThread(Flock &_flock, Rod &_rod, FishBook &_book, uint32_t _randSeed, bool _respawnCaughtFish, int tickRate)
+        : flock(_flock),
+          rod(_rod),
+          book(_book),
+          randSeed(_randSeed),
+          respawnCaughtFish(_respawnCaughtFish),
+          tickPeriod(1.0 / tickRate) {}
+
+    ~SimThread()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        publish(0.0f, 0);
+        running = true;
+        thread = std::thread([this]()
+                             { run(); });
+    }
+
+    void stop()
+    {
+        running = false;
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // Called from the render thread. Returns false if the sim thread is too far behind and the event was dropped.
+    bool send(const InputEvent &event)
+    {
+        return input.push(event);
+    }
+
+    // Tick at the tick rate until stopped. If a tick runs late the next one starts straight away, and the flock catches up (see Flock::maxSubsteps).
+    void run()
+    {
+        auto lastTick = std::chrono::steady_clock::now();
+        auto nextTick = lastTick;
+        while (running)
+        {
+            nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(tickPeriod);
+            std::this_thread::sleep_until(nextTick);
+
+            auto now = std::chrono::steady_clock::now();
+            if (now > nextTick)
+            {
+                nextTick = now;
+            }
+            float dt = std::chrono::duration<float>(now - lastTick).count();
+            lastTick = now;
+
+            tick(dt);
+        }
+    }
+
+    void handleInput(const InputEvent &event)
+    {
+        switch (event.type)
+        {
+        case InputEvent::Cast:
+            ripples.push_back(Ripple(32, {event.pos.x, event.pos.y}, 3.0f, 1.0f, randSeed));
+            rod.setCastPos(event.pos);
+            flock.addAffector(Affector(false, rod.castPos, 1.0f));
+            break;
+        case InputEvent::Pull:
+            flock.pull(rod);
+            rod.startPulling();
+            break;
+        case InputEvent::Resize:
+            flock.setWorldBounds(event.size.x, event.size.y);
+            flock.setView(event.pos, event.size);
+            break;
+        }
+    }
+
+    // Step everything by dt, then publish a snapshot
+    void tick(float dt)
+    {
+        auto tickStart = std::chrono::steady_clock::now();
+        uint64_t heapAllocationsBefore = heapAllocations;
+
+        InputEvent event;
+        while (input.pop(event))
+        {
+            handleInput(event);
+        }
+
+        // Update ripples
+        for (int i = ripples.size() - 1; i >= 0; i--)
+        {
+            ripples[i].update(dt);
+            if (ripples[i].done())
+            {
+                ripples.erase(ripples.begin() + i);
+            }
+        }
+
+        // Handle rod pulling
+        rod.update(dt);
+
+        if (rod.finishedPulling())
+        {
+            // Get pulled fish
+            const std::vector<CatchRecord> &catches = flock.finishPull(rod);
+
+            // Update fish book
+            coins += book.update(catches);
+
+            // Replace the caught fish
+            if (respawnCaughtFish)
+            {
+                for (size_t i = 0; i < catches.size(); i++)
+                {
+                    flock.addRandomFish(randInt(randSeed, flock.fishTypes.size()));
+                }
+            }
+
+            // Reset rod
+            rod.reset();
+        }
+
+        // Update flock
+        flock.update(dt, rod);
+
+        uint64_t simHeapAllocations = heapAllocations - heapAllocationsBefore;
+        publish(std::chrono::duration<float>(std::chrono::steady_clock::now() - tickStart).count(), simHeapAllocations);
+    }
+
+    // Copy what the render thread draws into the write buffer and hand it over
+    void publish(float tickTime, uint64_t simHeapAllocations)
+    {
+        SimSnapshot &snapshot = snapshots.writeBuffer();
+        flock.takeSnapshot(snapshot.flock);
+        snapshot.rod = rod;
+        snapshot.rippleArcs.clear();
+        for (const Ripple &ripple : ripples)
+        {
+            snapshot.rippleArcs.insert(snapshot.rippleArcs.end(), ripple.rippleArcs.begin(), ripple.rippleArcs.end());
+        }
+
+        snapshot.worldSize = {flock.worldWidth, flock.worldHeight};
+        snapshot.numFish = flock.allFish.size();
+        snapshot.neighborListRebuilds = flock.neighborListRebuilds;
+        snapshot.lodSkippedFish = flock.lodSkippedFish;
+        snapshot.simHeapAllocations = simHeapAllocations;
+        snapshot.droppedSimTime = flock.droppedSimTime;
+        snapshot.tickTime = tickTime;
+        snapshot.coins = coins;
+        snapshots.publish();
+    }
+};
+
+#endif
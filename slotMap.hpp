@@ -0,0 +1,79 @@
+#ifndef SLOT_MAP_HPP
+#define SLOT_MAP_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Refers to an item in a SlotMap. Stays valid while the item exists, even when items are moved around in memory,
+// and stops working once the item is removed, even if its slot is reused.
+struct Handle
+{
+    static constexpr uint32_t none = 0xFFFFFFFF;
+
+    uint32_t slot = none;
+    uint32_t generation = 0;
+
+    bool operator==(const Handle &other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const Handle &other) const { return !(*this == other); }
+};
+
+// Maps handles to the indices of items kept in dense arrays elsewhere (for example Flock::allFish).
+// The owner of the arrays calls setIndex whenever it moves an item, such as when swap-removing or reordering.
+struct SlotMap
+{
+    std::vector<uint32_t> indices;     // Index of the item in each slot. While a slot is free, the next free slot instead.
+    std::vector<uint32_t> generations; // Increased every time a slot is freed, so handles to the removed item stop working
+    std::vector<bool> used;
+    uint32_t firstFree = Handle::none;
+
+    // Get a handle for a new item at index
+    Handle add(uint32_t index)
+    {
+        uint32_t slot = firstFree;
+        if (slot != Handle::none)
+        {
+            firstFree = indices[slot];
+        }
+        else
+        {
+            slot = indices.size();
+            indices.push_back(0);
+            generations.push_back(0);
+            used.push_back(false);
+        }
+        indices[slot] = index;
+        used[slot] = true;
+        return {slot, generations[slot]};
+    }
+
+    // Free the slot of the item with handle. Does nothing if the handle doesn't work anymore.
+    void remove(Handle handle)
+    {
+        if (!contains(handle))
+            return;
+
+        generations[handle.slot]++;
+        used[handle.slot] = false;
+        indices[handle.slot] = firstFree;
+        firstFree = handle.slot;
+    }
+
+    bool contains(Handle handle) const
+    {
+        return handle.slot < indices.size() && used[handle.slot] && generations[handle.slot] == handle.generation;
+    }
+
+    // Get the index of the item with handle, or -1 if it was removed
+    int find(Handle handle) const
+    {
+        return contains(handle) ? (int)indices[handle.slot] : -1;
+    }
+
+    // Record that the item with handle is now at index
+    void setIndex(Handle handle, uint32_t index)
+    {
+        indices[handle.slot] = index;
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef SPATIAL_GRID_HPP
+#define SPATIAL_GRID_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <cmath>
+
+// Uniform grid of square cells used to find the points near a position without checking every point.
+// Points are bucketed with a counting sort, so the points in each cell are stored next to each other in cellEntries.
+struct SpatialGrid
+{
+    float cellSize = 1.0f;
+    glm::vec2 origin = {0.0f, 0.0f}; // World position of the corner of cell (0, 0)
+    int width = 0;                   // Number of cells along x
+    int height = 0;                  // Number of cells along y
+
+    std::vector<uint32_t> cellStart;   // cellEntries[cellStart[c]] to cellEntries[cellStart[c + 1] - 1] are the points in cell c
+    std::vector<uint32_t> cellEntries; // Point indices sorted by cell
+    std::vector<uint32_t> pointCells;  // The cell of each point, kept to avoid recomputing it during the sort
+    std::vector<uint32_t> nextSlot;    // Next free position in cellEntries for each cell while sorting
+
+    // Get the cell coordinate along one axis for a world coordinate, clamped to the grid
+    int cellCoord(float value, float axisOrigin, int cells) const
+    {
+        int coord = (int)std::floor((value - axisOrigin) / cellSize);
+        return std::clamp(coord, 0, cells - 1);
+    }
+
+    // Rebuild the grid around the points (xs[i], ys[i]). Cells are at least _cellSize wide.
+    void build(const float *xs, const float *ys, size_t count, float _cellSize)
+    {
+        cellSize = _cellSize;
+        if (count == 0)
+        {
+            width = 0;
+            height = 0;
+            cellStart.assign(1, 0);
+            cellEntries.clear();
+            return;
+        }
+
+        // Fit the grid to the points
+        glm::vec2 minPos = {xs[0], ys[0]};
+        glm::vec2 maxPos = {xs[0], ys[0]};
+        for (size_t i = 1; i < count; i++)
+        {
+            minPos = {std::min(minPos.x, xs[i]), std::min(minPos.y, ys[i])};
+            maxPos = {std::max(maxPos.x, xs[i]), std::max(maxPos.y, ys[i])};
+        }
+
+        // Grow the cells if a stray point would make the grid much larger than the number of points
+        size_t maxCells = std::max<size_t>(1024, count * 4);
+        while (true)
+        {
+            width = (int)((maxPos.x - minPos.x) / cellSize) + 1;
+            height = (int)((maxPos.y - minPos.y) / cellSize) + 1;
+            if ((size_t)width * (size_t)height <= maxCells)
+                break;
+            cellSize *= 2.0f;
+        }
+        origin = minPos;
+
+        // Reserve for the largest grid this many points can make, so the grid stops allocating once the flock size settles
+        cellStart.reserve(maxCells + 1);
+        nextSlot.reserve(maxCells);
+
+        // Count the points in each cell
+        cellStart.assign(width * height + 1, 0);
+        pointCells.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            int cx = cellCoord(xs[i], origin.x, width);
+            int cy = cellCoord(ys[i], origin.y, height);
+            pointCells[i] = cy * width + cx;
+            cellStart[pointCells[i] + 1]++;
+        }
+
+        // Turn the counts into start offsets
+        for (size_t c = 1; c < cellStart.size(); c++)
+        {
+            cellStart[c] += cellStart[c - 1];
+        }
+
+        // Place each point in its cell
+        cellEntries.resize(count);
+        nextSlot.assign(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            cellEntries[nextSlot[pointCells[i]]++] = (uint32_t)i;
+        }
+    }
+
+    // Call func(entries, count) once per cell that overlaps the square of half-size radius around pos, where entries[0] to entries[count - 1] are the points in that cell.
+    // Points further than radius away can be visited, so func still has to check the distance.
+    template <typename Func>
+    void forEachCellNear(glm::vec2 pos, float radius, Func func) const
+    {
+        if (width == 0 || height == 0)
+            return;
+
+        int minX = cellCoord(pos.x - radius, origin.x, width);
+        int maxX = cellCoord(pos.x + radius, origin.x, width);
+        int minY = cellCoord(pos.y - radius, origin.y, height);
+        int maxY = cellCoord(pos.y + radius, origin.y, height);
+
+        for (int cy = minY; cy <= maxY; cy++)
+        {
+            for (int cx = minX; cx <= maxX; cx++)
+            {
+                int cell = cy * width + cx;
+                uint32_t count = cellStart[cell + 1] - cellStart[cell];
+                if (count > 0)
+                {
+                    func(cellEntries.data() + cellStart[cell], (int)count);
+                }
+            }
+        }
+    }
+
+    // Call func(pointIndex) for every point in the cells that overlap the square of half-size radius around pos.
+    // Points further than radius away can be visited, so func still has to check the distance.
+    template <typename Func>
+    void forEachNear(glm::vec2 pos, float radius, Func func) const
+    {
+        forEachCellNear(pos, radius, [&](const uint32_t *entries, int count)
+                        {
+            for (int e = 0; e < count; e++)
+            {
+                func(entries[e]);
+            } });
+    }
+};
+
+#endif
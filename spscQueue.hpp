@@ -0,0 +1,42 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <cstddef>
+#include <atomic>
+
+// Fixed size queue for passing items from one producer thread to one consumer thread without locks.
+// Holds up to Capacity - 1 items. Neither push nor pop ever waits: push fails when the queue is full, pop when it is empty.
+template <typename T, size_t Capacity>
+struct SpscQueue
+{
+    T items[Capacity];
+    std::atomic<size_t> head{0}; // Next item to pop. Only advanced by the consumer.
+    std::atomic<size_t> tail{0}; // Where the next item is pushed. Only advanced by the producer.
+
+    // Add an item to the back of the queue. Returns false, dropping the item, if the queue is full.
+    bool push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % Capacity;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Take the item at the front of the queue. Returns false if the queue is empty.
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = items[h];
+        head.store((h + 1) % Capacity, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+
+// A fixed set of worker threads that split loops between them.
+// The thread calling parallelFor also does work, so a pool of N threads only starts N - 1 extra threads.
+struct ThreadPool
+{
+    int numThreads;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition; // Signalled when a new loop is started or the pool is stopping
+    std::condition_variable doneCondition; // Signalled when a worker finishes its share of the loop
+
+    // The current loop
+    std::function<void(size_t, size_t, int)> job;
+    size_t jobCount = 0;
+    size_t chunkSize = 1;
+    std::atomic<size_t> nextChunk{0};
+    int busyWorkers = 0;
+    uint64_t generation = 0; // Increased for every loop so sleeping workers can tell a new loop started
+    bool stopping = false;
+
+    ThreadPool(int _numThreads)
+        : numThreads(std::max(1, _numThreads))
+    {
+        for (int i = 1; i < numThreads; i++)
+        {
+            workers.emplace_back([this, i]()
+                                 { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    // Run func(begin, end, threadIndex) over chunks that cover [0, count), returning once every chunk is done.
+    // threadIndex is in [0, numThreads) and can be used to pick per-thread scratch memory.
+    void parallelFor(size_t count, const std::function<void(size_t, size_t, int)> &func)
+    {
+        if (count == 0)
+            return;
+
+        // Not worth waking the workers
+        if (workers.empty() || count < 2)
+        {
+            func(0, count, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = func;
+            jobCount = count;
+            chunkSize = std::max<size_t>(1, count / (numThreads * 4)); // A few chunks per thread to even out the load
+            nextChunk = 0;
+            busyWorkers = workers.size();
+            generation++;
+        }
+        wakeCondition.notify_all();
+
+        runChunks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [this]()
+                           { return busyWorkers == 0; });
+        job = nullptr;
+    }
+
+    // Take chunks of the current loop until there are none left
+    void runChunks(int threadIndex)
+    {
+        while (true)
+        {
+            size_t begin = nextChunk.fetch_add(chunkSize);
+            if (begin >= jobCount)
+                return;
+            job(begin, std::min(begin + chunkSize, jobCount), threadIndex);
+        }
+    }
+
+    void workerLoop(int threadIndex)
+    {
+        uint64_t seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&]()
+                                   { return stopping || generation != seenGeneration; });
+                if (stopping)
+                    return;
+                seenGeneration = generation;
+            }
+
+            runChunks(threadIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busyWorkers--;
+            }
+            doneCondition.notify_one();
+        }
+    }
+};
+
+#endif
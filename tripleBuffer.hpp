@@ -0,0 +1,43 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <cstdint>
+#include <atomic>
+
+// Hands the latest version of a value from one writer thread to one reader thread without either of them ever waiting.
+// The writer fills writeBuffer() and calls publish. The reader calls update, then uses readBuffer() until its next update.
+// The third buffer sits between them, so the writer always has a buffer the reader isn't using and the reader always has a complete one.
+// Published versions the reader doesn't get to are skipped, and the writer fills a buffer it gets back from scratch.
+template <typename T>
+struct TripleBuffer
+{
+    static constexpr uint8_t indexMask = 3;
+    static constexpr uint8_t freshBit = 4; // Set in middle when it holds a version the reader hasn't taken yet
+
+    T buffers[3];
+    std::atomic<uint8_t> middle{1}; // Index of the buffer between the threads, plus freshBit
+    uint8_t back = 0;               // Only used by the writer
+    uint8_t front = 2;              // Only used by the reader
+
+    T &writeBuffer() { return buffers[back]; }
+
+    // Make the write buffer the latest version, and take the middle buffer to write the next one into
+    void publish()
+    {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Take the latest published version, if there is one the reader doesn't have yet. Returns true if the read buffer changed.
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit))
+            return false;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    T &readBuffer() { return buffers[front]; }
+};
+
+#endif